@@ -37,7 +37,9 @@
 #include "trap.h"
 #include "mmu.h"
 #include "disasm.h"
+#include "checkpoint.h"
 #include <cstdlib>
+#include <stdexcept>
 #include <tgmath.h>
 #include <stdio.h>
 #include <stdarg.h>
@@ -157,33 +159,56 @@ struct : public arg_t {
   }
 } uimm;
 
-template<class tag_t, unsigned int N>
-constexpr unsigned int extract_tags_count(const tags_t<tag_t, N>&) { return N; }
+void cheri_t::create_tagged_memory() {
+  if (!p->sim)
+    return;
+  for (auto& mem : p->sim->get_mems())
+    mem_tags.add_range(mem.first, mem.second->size());
+}
 
 bool cheri_t::get_tag(reg_t addr) {
   reg_t paddr = MMU.translate(addr, sizeof(cheri_reg_inmem_t), LOAD);
   return get_tag_translated(paddr);
 }
 
-bool cheri_t::get_tag_translated(reg_t paddr) {
-  paddr -= DRAM_BASE;
-  paddr >>= (int) log2(sizeof(cheri_reg_inmem_t));
-
-  if (paddr >= extract_tags_count(mem_tags)) return false;
-  return mem_tags.getTag(paddr);
-}
-
 void cheri_t::set_tag(reg_t addr, bool val) {
   reg_t paddr = MMU.translate(addr, sizeof(cheri_reg_inmem_t), STORE);
   set_tag_translated(paddr, val);
 }
 
-void cheri_t::set_tag_translated(reg_t paddr, bool val) {
-  paddr -= DRAM_BASE;
-  paddr >>= (int) log2(sizeof(cheri_reg_inmem_t));
+template <size_t N, bool zero_reg>
+static void checkpoint_regfile(checkpoint_t& cp, regfile_t<cheri_reg_t, N, zero_reg>& rf)
+{
+  for (size_t i = 0; i < N; i++) {
+    cheri_reg_t r = rf[i];
+    cp.field(r);
+    rf.write(i, r);
+  }
+}
 
-  if (paddr >= extract_tags_count(mem_tags)) return;
-  mem_tags.setTag(paddr, val);
+void cheri_t::checkpoint(checkpoint_t& cp) {
+#ifndef CHERI_MERGED_RF
+  checkpoint_regfile(cp, state.reg_file);
+#endif
+  checkpoint_regfile(cp, state.scrs_reg_file);
+  pcc_changed();
+  cp.field(clen);
+  cp.field(ccsr);
+
+  /* Tags are sparse, so only the addresses of set tags are stored. */
+  std::vector<uint64_t> set;
+  if (cp.saving())
+    mem_tags.for_each([&](reg_t paddr) { set.push_back(paddr); });
+  uint64_t count = set.size();
+  cp.field(count);
+  set.resize(count);
+  if (count)
+    cp.bytes(&set[0], count * sizeof(set[0]));
+  if (!cp.saving()) {
+    mem_tags.reset();
+    for (auto paddr : set)
+      mem_tags.set(paddr, true);
+  }
 }
 
 #define CHERI_REGISTER_INSN(cheri, name, match, mask) \
@@ -420,6 +445,8 @@ void cheri_t::reset() {
   fprintf(stderr, "cheri.cc: resetting cheri regs.\n");
 #endif //DEBUG
 
+  if (mem_tags.empty())
+    create_tagged_memory();
   mem_tags.reset();
 
   ccsr = 0;
@@ -433,6 +460,7 @@ void cheri_t::reset() {
   /* Initialize pcc and ddc */
   /* FIXME: Need to decide what permissions to be set for PCC (i.e. no store) */
   state.scrs_reg_file.write(CHERI_SCR_PCC, CHERI_ALMIGHTY_CAP);
+  pcc_changed();
   /* FIXME: Need to decide what permissions to be set for DDC (i.e. no execute); */
   state.scrs_reg_file.write(CHERI_SCR_DDC, CHERI_ALMIGHTY_CAP);
 
@@ -461,6 +489,7 @@ void cheri_t::set_scr(int index, cheri_reg_t val, processor_t* proc) {
   switch (index) {
     case CHERI_SCR_PCC:
       proc->state.pc = offset;
+      pcc_changed();
       break;
     // case CHERI_SCR_UTCC:
     //   proc->state.utvec = offset;
@@ -121,6 +121,7 @@ class cheri_t : public extension_t {
 
   /* Override extension functions */
   void reset();
+  void checkpoint(checkpoint_t& cp);
 
   void register_insn(insn_desc_t desc);
 
@@ -147,12 +148,41 @@ class cheri_t : public extension_t {
     }
   }
 
-  /* Allocate tag_bits memory to cover all memory */
-  void create_tagged_memory(size_t memsz);
+  /*
+   * PCC's bounds and permissions only change when PCC is written, so the
+   * MMU can skip check_ifetch_granule for fetches within its bounds until
+   * pcc_changed() is called.
+   */
+  void get_fetch_bounds(reg_t* lo, reg_t* hi) {
+    cheri_reg_t pcc = state.scrs_reg_file[CHERI_SCR_PCC];
+    if (!pcc.tag || pcc.sealed() || !(pcc.perms & BIT(CHERI_PERMIT_EXECUTE))) {
+      *lo = -1;
+      *hi = 0;
+      return;
+    }
+    *lo = pcc.base();
+    *hi = pcc.top() > (cheri_length_t)UINT64_MAX ? UINT64_MAX : (reg_t)pcc.top();
+  }
+
+  void pcc_changed() {
+    p->get_mmu()->flush_fetch_bounds();
+  }
+
+  /* Cover every memory range of the simulator with tags */
+  void create_tagged_memory();
   bool get_tag(reg_t addr);
-  bool get_tag_translated(reg_t paddr);
   void set_tag(reg_t addr, bool val);
-  void set_tag_translated(reg_t paddr, bool val);
+
+  bool get_tag_translated(reg_t paddr) {
+    return mem_tags.get(paddr);
+  }
+  void set_tag_translated(reg_t paddr, bool val) {
+    mem_tags.set(paddr, val);
+  }
+  /* Clear the tags of all capabilities overlapping [paddr, paddr + len) */
+  void clear_tags_translated(reg_t paddr, reg_t len) {
+    mem_tags.clear(paddr, len);
+  }
 
   uint32_t get_clen() {
     return clen;
@@ -280,7 +310,7 @@ class cheri_t : public extension_t {
                       /*cap_op=*/false, /*store_local=*/false); \
       reg_t paddr; \
       MMU.store_##type(addr, val, &paddr); \
-      set_tag_translated(paddr, false); \
+      clear_tags_translated(paddr, sizeof(type##_t)); \
     } \
     \
     inline void ddc_store_##type(reg_t addr, type##_t val) { \
@@ -315,8 +345,7 @@ class cheri_t : public extension_t {
   }
 
  private:
-  /* FIXME: For now assume DRAM size is 2GiB, the default for Spike */
-  tags_t<bool, (BIT(31) / sizeof(cheri_reg_inmem_t))> mem_tags;
+  tags_t<sizeof(cheri_reg_inmem_t)> mem_tags;
   uint32_t clen = 0;
   reg_t ccsr = 0;
   std::vector<insn_desc_t> instructions;
@@ -2,12 +2,5 @@
 
 #include <config.h>
 #ifdef ENABLE_CHERI
-#include "arith.h"
-#include "mmu.h"
-#include "softfloat.h"
-#include "internals.h"
-#include "specialize.h"
-#include "tracer.h"
-#include "cheri.h"
-#include <assert.h>
+#include "insn_template.h"
 #endif
@@ -39,6 +39,6 @@ switch(insn.chs()) {
     break;
 
   default:
-    throw trap_illegal_instruction(0);
+    return_trap(trap_illegal_instruction(0));
     break;
 }
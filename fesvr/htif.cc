@@ -121,7 +121,7 @@ std::map<std::string, uint64_t> htif_t::load_payload(const std::string& payload,
 
 void htif_t::load_program()
 {
-  std::map<std::string, uint64_t> symbols = load_payload(targs[0], &entry);
+  symbols = load_payload(targs[0], &entry);
 
   if (symbols.count("tohost") && symbols.count("fromhost")) {
     tohost_addr = symbols["tohost"];
@@ -140,7 +140,8 @@ void htif_t::load_program()
   for (auto payload : payloads)
   {
     reg_t dummy_entry;
-    load_payload(payload, &dummy_entry);
+    auto payload_symbols = load_payload(payload, &dummy_entry);
+    symbols.insert(payload_symbols.begin(), payload_symbols.end());
   }
 }
 
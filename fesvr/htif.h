@@ -27,6 +27,9 @@ class htif_t : public chunked_memif_t
 
   virtual memif_t& memif() { return mem; }
 
+  // symbols of the loaded program and payloads, by name
+  const std::map<std::string, uint64_t>& get_symbols() { return symbols; }
+
  protected:
   virtual void reset() = 0;
 
@@ -72,6 +75,7 @@ class htif_t : public chunked_memif_t
   bcd_t bcd;
   std::vector<device_t*> dynamic_devices;
   std::vector<std::string> payloads;
+  std::map<std::string, uint64_t> symbols;
 
   const std::vector<std::string>& target_args() { return targs; }
 
@@ -2,13 +2,16 @@
 // See LICENSE_CHERI for license details.
 
 #include "cachesim.h"
+#include "coherence.h"
 #include "common.h"
 #include <cstdlib>
 #include <iostream>
 #include <iomanip>
 
-cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char* _name)
-: sets(_sets), ways(_ways), linesz(_linesz), name(_name), log(false)
+cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char* _name,
+                         replacement_policy_t _policy, prefetcher_t* _prefetcher)
+: sets(_sets), ways(_ways), linesz(_linesz), policy(_policy),
+  prefetcher(_prefetcher), name(_name), log(false)
 {
   init();
 }
@@ -16,9 +19,11 @@ cache_sim_t::cache_sim_t(size_t _sets, size_t _ways, size_t _linesz, const char*
 static void help()
 {
   std::cerr << "Cache configurations must be of the form" << std::endl;
-  std::cerr << "  sets:ways:blocksize" << std::endl;
+  std::cerr << "  sets:ways:blocksize[:policy][:prefetcher]" << std::endl;
   std::cerr << "where sets, ways, and blocksize are positive integers, with" << std::endl;
   std::cerr << "sets and blocksize both powers of two and blocksize at least 8." << std::endl;
+  std::cerr << "policy is random (the default), lru, plru or srrip; plru needs" << std::endl;
+  std::cerr << "ways to be a power of two. prefetcher is nextline or stride." << std::endl;
   exit(1);
 }
 
@@ -33,9 +38,29 @@ cache_sim_t* cache_sim_t::construct(const char* config, const char* name)
   size_t ways = atoi(std::string(wp, bp).c_str());
   size_t linesz = atoi(bp);
 
+  replacement_policy_t policy = RANDOM;
+  prefetcher_t* prefetcher = NULL;
+  for (const char* p = strchr(bp, ':'); p; ) {
+    const char* end = strchr(++p, ':');
+    std::string opt = end ? std::string(p, end) : std::string(p);
+    if (opt == "random")
+      policy = RANDOM;
+    else if (opt == "lru")
+      policy = LRU;
+    else if (opt == "plru" && ways && !(ways & (ways - 1)))
+      policy = PLRU;
+    else if (opt == "srrip")
+      policy = SRRIP;
+    else if (!prefetcher && (prefetcher = prefetcher_t::construct(opt)))
+      ;
+    else
+      help();
+    p = end;
+  }
+
   if (ways > 4 /* empirical */ && sets == 1)
-    return new fa_cache_sim_t(ways, linesz, name);
-  return new cache_sim_t(sets, ways, linesz, name);
+    return new fa_cache_sim_t(ways, linesz, name, policy, prefetcher);
+  return new cache_sim_t(sets, ways, linesz, name, policy, prefetcher);
 }
 
 void cache_sim_t::init()
@@ -44,12 +69,19 @@ void cache_sim_t::init()
     help();
   if(linesz < 8 || (linesz & (linesz-1)))
     help();
+  if(ways == 0)
+    help();
 
   idx_shift = 0;
   for (size_t x = linesz; x>1; x >>= 1)
     idx_shift++;
 
   tags = new uint64_t[sets*ways]();
+  repl = new uint64_t[sets*ways]();
+  repl_clock = 0;
+  demand_accesses = 0;
+  coherence = NULL;
+  coherence_id = 0;
   read_accesses = 0;
   read_misses = 0;
   bytes_read = 0;
@@ -57,22 +89,34 @@ void cache_sim_t::init()
   write_misses = 0;
   bytes_written = 0;
   writebacks = 0;
+  prefetches = 0;
+  useful_prefetches = 0;
+  late_prefetches = 0;
+  useless_prefetches = 0;
 
   miss_handler = NULL;
 }
 
 cache_sim_t::cache_sim_t(const cache_sim_t& rhs)
  : sets(rhs.sets), ways(rhs.ways), linesz(rhs.linesz),
-   idx_shift(rhs.idx_shift), name(rhs.name), log(false)
+   idx_shift(rhs.idx_shift), policy(rhs.policy), repl_clock(rhs.repl_clock),
+   prefetcher(rhs.prefetcher ? rhs.prefetcher->clone() : NULL),
+   prefetch_queue(rhs.prefetch_queue), demand_accesses(rhs.demand_accesses),
+   coherence(NULL), coherence_id(0),
+   name(rhs.name), log(false)
 {
   tags = new uint64_t[sets*ways];
   memcpy(tags, rhs.tags, sets*ways*sizeof(uint64_t));
+  repl = new uint64_t[sets*ways];
+  memcpy(repl, rhs.repl, sets*ways*sizeof(uint64_t));
 }
 
 cache_sim_t::~cache_sim_t()
 {
   print_stats();
   delete [] tags;
+  delete [] repl;
+  delete prefetcher;
 }
 
 void cache_sim_t::print_stats()
@@ -99,15 +143,26 @@ void cache_sim_t::print_stats()
   std::cout << "Writebacks:            " << writebacks << std::endl;
   std::cout << name << " ";
   std::cout << "Miss Rate:             " << mr << '%' << std::endl;
+  if (!prefetcher)
+    return;
+  std::cout << name << " ";
+  std::cout << "Prefetches:            " << prefetches << std::endl;
+  std::cout << name << " ";
+  std::cout << "Useful Prefetches:     " << useful_prefetches << std::endl;
+  std::cout << name << " ";
+  std::cout << "Late Prefetches:       " << late_prefetches << std::endl;
+  std::cout << name << " ";
+  std::cout << "Useless Prefetches:    " << useless_prefetches << std::endl;
 }
 
 void cache_sim_t::read_counter(uint64_t *ret_value, int idx)
 {
   int cache_index = 0;
 
-  if (name == "I$")
+  // per-hart caches are named I$0, D$1 and so on
+  if (name.compare(0, 2, "I$") == 0)
       cache_index = 0;
-  else if (name == "D$")
+  else if (name.compare(0, 2, "D$") == 0)
       cache_index = 7;
   else if (name == "L2$")
       cache_index = 14;
@@ -136,31 +191,202 @@ uint64_t* cache_sim_t::check_tag(uint64_t addr)
   size_t tag = (addr >> idx_shift) | VALID;
 
   for (size_t i = 0; i < ways; i++)
-    if (tag == (tags[idx*ways + i] & ~DIRTY))
+    if (tag == (tags[idx*ways + i] & ~LINE_STATE))
       return &tags[idx*ways + i];
 
   return NULL;
 }
 
+void cache_sim_t::set_coherence(coherence_t* c)
+{
+  coherence = c;
+  coherence_id = c->add(this);
+}
+
+void cache_sim_t::invalidate(uint64_t addr)
+{
+  if (uint64_t* tag = check_tag(addr))
+    *tag = 0;
+}
+
+// Picks the way to replace in a set. Random replacement may evict a valid
+// line while others are still empty; the other policies fill empty ways first.
+size_t cache_sim_t::choose_victim(size_t set)
+{
+  uint64_t* set_tags = &tags[set*ways];
+  uint64_t* set_repl = &repl[set*ways];
+  if (policy != RANDOM) {
+    for (size_t i = 0; i < ways; i++)
+      if (!(set_tags[i] & VALID))
+        return i;
+  }
+
+  switch (policy) {
+    case RANDOM:
+      return lfsr.next() % ways;
+    case LRU: {
+      size_t way = 0;
+      for (size_t i = 1; i < ways; i++)
+        if (set_repl[i] < set_repl[way])
+          way = i;
+      return way;
+    }
+    case PLRU: {
+      // each node bit points to the half of its subtree used less recently
+      size_t node = 0, way = 0;
+      for (size_t half = ways / 2; half > 0; half /= 2) {
+        bool right = set_repl[node];
+        node = 2 * node + 1 + right;
+        way += right ? half : 0;
+      }
+      return way;
+    }
+    case SRRIP:
+      while (true) {
+        for (size_t i = 0; i < ways; i++)
+          if (set_repl[i] == 3)
+            return i;
+        for (size_t i = 0; i < ways; i++)
+          set_repl[i]++;
+      }
+  }
+  abort();
+}
+
+// Updates the replacement state for a hit on line (fill = false) or for a
+// new line put there (fill = true).
+void cache_sim_t::touch(size_t line, bool fill)
+{
+  size_t set = line / ways, way = line % ways;
+  switch (policy) {
+    case RANDOM:
+      break;
+    case LRU:
+      repl[line] = ++repl_clock;
+      break;
+    case PLRU: {
+      uint64_t* set_repl = &repl[set*ways];
+      size_t node = 0;
+      for (size_t half = ways / 2; half > 0; half /= 2) {
+        bool right = way & half;
+        set_repl[node] = !right;
+        node = 2 * node + 1 + right;
+      }
+      break;
+    }
+    case SRRIP:
+      // new lines are predicted to be re-referenced in the distant future
+      repl[line] = fill ? 2 : 0;
+      break;
+  }
+}
+
 uint64_t cache_sim_t::victimize(uint64_t addr)
 {
   size_t idx = (addr >> idx_shift) & (sets-1);
-  size_t way = lfsr.next() % ways;
+  size_t way = choose_victim(idx);
   uint64_t victim = tags[idx*ways + way];
   tags[idx*ways + way] = (addr >> idx_shift) | VALID;
+  touch(idx*ways + way, true);
   return victim;
 }
 
+// Puts addr's line in the cache, writing back the line it replaces, and
+// reads it from the next level if fetch is set.
+void cache_sim_t::fill(uint64_t addr, bool fetch)
+{
+  uint64_t victim = victimize(addr);
+
+  if ((victim & (VALID | DIRTY)) == (VALID | DIRTY))
+  {
+    uint64_t dirty_addr = (victim & ~(VALID | LINE_STATE)) << idx_shift;
+    if (miss_handler)
+      miss_handler->access(dirty_addr, linesz, true);
+    writebacks++;
+  }
+  if ((victim & (VALID | PREFETCHED)) == (VALID | PREFETCHED))
+    useless_prefetches++;
+
+  if (fetch && miss_handler)
+    miss_handler->access(addr & ~(linesz-1), linesz, false);
+}
+
+// Puts the prefetches that are due into the cache, and returns whether line
+// is still on its way.
+bool cache_sim_t::land_prefetches(uint64_t line)
+{
+  bool in_flight = false;
+  for (size_t i = 0; i < prefetch_queue.size(); ) {
+    if (prefetch_queue[i].first == line) {
+      in_flight = true;
+    } else if (prefetch_queue[i].second <= demand_accesses) {
+      uint64_t addr = prefetch_queue[i].first << idx_shift;
+      if (!check_tag(addr)) {
+        bool shared = false, supplied = false;
+        if (coherence)
+          coherence->fetch(coherence_id, addr, false, &shared, &supplied);
+        fill(addr, false);
+        *check_tag(addr) |= PREFETCHED | (shared ? 0 : EXCLUSIVE);
+      }
+    } else {
+      i++;
+      continue;
+    }
+    prefetch_queue.erase(prefetch_queue.begin() + i);
+  }
+  return in_flight;
+}
+
+void cache_sim_t::issue_prefetches(uint64_t line, bool miss)
+{
+  prefetch_candidates.clear();
+  prefetcher->access(line, miss, prefetch_candidates);
+  for (uint64_t candidate : prefetch_candidates) {
+    if (prefetch_queue.size() == PREFETCH_QUEUE)
+      break;
+    bool queued = false;
+    for (auto& p : prefetch_queue)
+      queued |= p.first == candidate;
+    if (queued || check_tag(candidate << idx_shift))
+      continue;
+    prefetch_queue.push_back(std::make_pair(candidate, demand_accesses + PREFETCH_LATENCY));
+    prefetches++;
+    if (miss_handler)
+      miss_handler->access(candidate << idx_shift, linesz, false);
+  }
+}
+
 void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
 {
   store ? write_accesses++ : read_accesses++;
   (store ? bytes_written : bytes_read) += bytes;
 
+  // a line fetched by a late prefetch is already on its way from the next level
+  bool late = false;
+  if (unlikely(prefetcher != NULL)) {
+    demand_accesses++;
+    late = land_prefetches(addr >> idx_shift);
+  }
+
   uint64_t* hit_way = check_tag(addr);
   if (likely(hit_way != NULL))
   {
+    if (unlikely(*hit_way & PREFETCHED)) {
+      useful_prefetches++;
+      *hit_way &= ~PREFETCHED;
+    }
+    touch(hit_way - tags, false);
     if (store)
       *hit_way |= DIRTY;
+    if (unlikely(coherence != NULL) && store) {
+      if (!(*hit_way & EXCLUSIVE)) {
+        coherence->upgrade(coherence_id, addr);
+        *hit_way |= EXCLUSIVE;
+      }
+      coherence->store(coherence_id, addr, bytes);
+    }
+    if (unlikely(prefetcher != NULL))
+      issue_prefetches(addr >> idx_shift, false);
     return;
   }
 
@@ -172,44 +398,142 @@ void cache_sim_t::access(uint64_t addr, size_t bytes, bool store)
               << std::hex << addr << std::endl;
   }
 
-  uint64_t victim = victimize(addr);
-
-  if ((victim & (VALID | DIRTY)) == (VALID | DIRTY))
-  {
-    uint64_t dirty_addr = (victim & ~(VALID | DIRTY)) << idx_shift;
-    if (miss_handler)
-      miss_handler->access(dirty_addr, linesz, true);
-    writebacks++;
+  // another cache may supply the line instead of the next level
+  bool shared = false, supplied = false;
+  if (unlikely(coherence != NULL)) {
+    coherence->demand_miss(coherence_id, addr, bytes);
+    coherence->fetch(coherence_id, addr, store, &shared, &supplied);
   }
 
-  if (miss_handler)
-    miss_handler->access(addr & ~(linesz-1), linesz, false);
+  if (late)
+    late_prefetches++;
+  fill(addr, !late && !supplied);
 
   if (store)
     *check_tag(addr) |= DIRTY;
+  if (unlikely(coherence != NULL)) {
+    if (!shared)
+      *check_tag(addr) |= EXCLUSIVE;
+    if (store)
+      coherence->store(coherence_id, addr, bytes);
+  }
+  if (unlikely(prefetcher != NULL))
+    issue_prefetches(addr >> idx_shift, true);
+}
+
+fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char* name,
+                               replacement_policy_t policy, prefetcher_t* prefetcher)
+  : cache_sim_t(1, ways, linesz, name, policy, prefetcher), used(0)
+{
+  size_t slots = 1;
+  while (slots < 2 * ways)
+    slots *= 2;
+  index_keys.assign(slots, 0);
+  index_ways.assign(slots, 0);
 }
 
-fa_cache_sim_t::fa_cache_sim_t(size_t ways, size_t linesz, const char* name)
-  : cache_sim_t(1, ways, linesz, name)
+// the slot holding key, or the empty slot where it would go
+size_t fa_cache_sim_t::slot(uint64_t key)
 {
+  size_t mask = index_keys.size() - 1;
+  size_t i = (key * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+  while (index_keys[i] != key && index_keys[i] != 0)
+    i = (i + 1) & mask;
+  return i;
+}
+
+void fa_cache_sim_t::erase(uint64_t key)
+{
+  // backward-shift deletion keeps every probe sequence unbroken
+  size_t mask = index_keys.size() - 1;
+  size_t i = slot(key);
+  for (size_t j = (i + 1) & mask; index_keys[j] != 0; j = (j + 1) & mask) {
+    size_t home = (index_keys[j] * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      index_keys[i] = index_keys[j];
+      index_ways[i] = index_ways[j];
+      i = j;
+    }
+  }
+  index_keys[i] = 0;
 }
 
 uint64_t* fa_cache_sim_t::check_tag(uint64_t addr)
 {
-  auto it = tags.find(addr >> idx_shift);
-  return it == tags.end() ? NULL : &it->second;
+  size_t i = slot((addr >> idx_shift) | VALID);
+  return index_keys[i] ? &tags[index_ways[i]] : NULL;
+}
+
+void fa_cache_sim_t::invalidate(uint64_t addr)
+{
+  uint64_t key = (addr >> idx_shift) | VALID;
+  size_t i = slot(key);
+  if (index_keys[i]) {
+    tags[index_ways[i]] = 0;
+    erase(key);
+  }
 }
 
 uint64_t fa_cache_sim_t::victimize(uint64_t addr)
 {
-  uint64_t old_tag = 0;
-  if (tags.size() == ways)
-  {
-    auto it = tags.begin();
-    std::advance(it, lfsr.next() % ways);
-    old_tag = it->second;
-    tags.erase(it);
+  size_t way = used < ways ? used++ : choose_victim(0);
+  uint64_t victim = tags[way];
+  if (victim & VALID)
+    erase(victim & ~LINE_STATE);
+
+  uint64_t key = (addr >> idx_shift) | VALID;
+  size_t i = slot(key);
+  index_keys[i] = key;
+  index_ways[i] = way;
+  tags[way] = key;
+  touch(way, true);
+  return victim;
+}
+
+prefetcher_t* prefetcher_t::construct(const std::string& name)
+{
+  if (name == "nextline")
+    return new next_line_prefetcher_t;
+  if (name == "stride")
+    return new stride_prefetcher_t;
+  return NULL;
+}
+
+void next_line_prefetcher_t::access(uint64_t line, bool miss, std::vector<uint64_t>& out)
+{
+  if (miss)
+    out.push_back(line + 1);
+}
+
+stride_prefetcher_t::stride_prefetcher_t()
+{
+  for (auto& e : table)
+    e = {uint64_t(-1), 0, 0, 0};
+}
+
+void stride_prefetcher_t::access(uint64_t line, bool miss, std::vector<uint64_t>& out)
+{
+  uint64_t region = line / REGION_LINES;
+  entry_t& e = table[region % ENTRIES];
+  if (e.region != region) {
+    e = {region, line, 0, 0};
+    return;
+  }
+
+  int64_t stride = line - e.last;
+  if (stride == 0)
+    return;
+  if (stride == e.stride) {
+    if (e.confidence < 2)
+      e.confidence++;
+  } else {
+    e.stride = stride;
+    e.confidence = 0;
+  }
+  e.last = line;
+
+  if (e.confidence == 2) {
+    for (int i = 1; i <= DEGREE; i++)
+      out.push_back(line + i * stride);
   }
-  tags[addr >> idx_shift] = (addr >> idx_shift) | VALID;
-  return old_tag;
 }
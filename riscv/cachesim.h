@@ -7,10 +7,12 @@
 #include "memtracer.h"
 #include <cstring>
 #include <string>
-#include <map>
+#include <vector>
+#include <utility>
 #include <cstdint>
 
 class cache_memtracer_t;
+class coherence_t;
 class lfsr_t
 {
  public:
@@ -21,10 +23,55 @@ class lfsr_t
   uint32_t reg;
 };
 
+// A prefetcher watches the demand accesses to a cache and names the lines
+// to fetch ahead of them. Lines are addresses divided by the line size.
+class prefetcher_t
+{
+ public:
+  virtual ~prefetcher_t() {}
+  virtual void access(uint64_t line, bool miss, std::vector<uint64_t>& out) = 0;
+  virtual prefetcher_t* clone() const = 0;
+
+  // returns NULL if there is no prefetcher of that name
+  static prefetcher_t* construct(const std::string& name);
+};
+
+// on each miss, fetch the following line
+class next_line_prefetcher_t : public prefetcher_t
+{
+ public:
+  void access(uint64_t line, bool miss, std::vector<uint64_t>& out);
+  prefetcher_t* clone() const { return new next_line_prefetcher_t(*this); }
+};
+
+// once two successive accesses within a region have repeated a stride,
+// fetch the next DEGREE lines along it
+class stride_prefetcher_t : public prefetcher_t
+{
+ public:
+  stride_prefetcher_t();
+  void access(uint64_t line, bool miss, std::vector<uint64_t>& out);
+  prefetcher_t* clone() const { return new stride_prefetcher_t(*this); }
+ private:
+  static const size_t ENTRIES = 64;
+  static const size_t REGION_LINES = 64;
+  static const int DEGREE = 4;
+  struct entry_t {
+    uint64_t region;
+    uint64_t last;
+    int64_t stride;
+    unsigned confidence;
+  };
+  entry_t table[ENTRIES];
+};
+
 class cache_sim_t
 {
  public:
-  cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name);
+  enum replacement_policy_t { RANDOM, LRU, PLRU, SRRIP };
+
+  cache_sim_t(size_t sets, size_t ways, size_t linesz, const char* name,
+              replacement_policy_t policy = RANDOM, prefetcher_t* prefetcher = NULL);
   cache_sim_t(const cache_sim_t& rhs);
   virtual ~cache_sim_t();
 
@@ -32,6 +79,7 @@ class cache_sim_t
   void print_stats();
   void set_miss_handler(cache_sim_t* mh) { miss_handler = mh; }
   void set_log(bool _log) { log = _log; }
+  void set_coherence(coherence_t* c);
   void read_counter(uint64_t *ret_value, int counter_id);
 
   static cache_sim_t* construct(const char* config, const char* name);
@@ -39,9 +87,18 @@ class cache_sim_t
  protected:
   static const uint64_t VALID = 1ULL << 63;
   static const uint64_t DIRTY = 1ULL << 62;
+  static const uint64_t PREFETCHED = 1ULL << 61; // not yet used by a demand access
+  static const uint64_t EXCLUSIVE = 1ULL << 60;  // held by no other coherent cache
+  static const uint64_t LINE_STATE = DIRTY | PREFETCHED | EXCLUSIVE;
 
   virtual uint64_t* check_tag(uint64_t addr);
   virtual uint64_t victimize(uint64_t addr);
+  virtual void invalidate(uint64_t addr);
+  size_t choose_victim(size_t set);
+  void touch(size_t line, bool fill);
+  void fill(uint64_t addr, bool fetch);
+  void issue_prefetches(uint64_t line, bool miss);
+  bool land_prefetches(uint64_t line);
 
   lfsr_t lfsr;
   cache_sim_t* miss_handler;
@@ -52,7 +109,29 @@ class cache_sim_t
   size_t idx_shift;
 
   uint64_t* tags;
-  
+
+  // Replacement state for each line (sets*ways entries): the time of last
+  // use for LRU, the re-reference prediction for SRRIP, and for tree-PLRU
+  // the ways-1 node bits of each set's tree, stored in its first entries.
+  replacement_policy_t policy;
+  uint64_t* repl;
+  uint64_t repl_clock;
+
+  // Prefetches are issued to the next level at once but only land in this
+  // cache PREFETCH_LATENCY demand accesses later; a demand miss to a line
+  // still in flight makes the prefetch late.
+  static const size_t PREFETCH_LATENCY = 4;
+  static const size_t PREFETCH_QUEUE = 16;
+  prefetcher_t* prefetcher;
+  std::vector<std::pair<uint64_t, uint64_t>> prefetch_queue; // line, due
+  std::vector<uint64_t> prefetch_candidates;
+  uint64_t demand_accesses;
+
+  // MESI state is kept in the tags: M is DIRTY and EXCLUSIVE, E is EXCLUSIVE
+  // alone and S is neither.
+  coherence_t* coherence;
+  size_t coherence_id;
+
   uint64_t read_accesses;
   uint64_t read_misses;
   uint64_t bytes_read;
@@ -60,8 +139,13 @@ class cache_sim_t
   uint64_t write_misses;
   uint64_t bytes_written;
   uint64_t writebacks;
+  uint64_t prefetches;
+  uint64_t useful_prefetches;
+  uint64_t late_prefetches;
+  uint64_t useless_prefetches;
 
   friend cache_memtracer_t;
+  friend coherence_t;
 
   std::string name;
   bool log;
@@ -69,15 +153,22 @@ class cache_sim_t
   void init();
 };
 
+// A fully-associative cache. The tags stay in the flat array of the base
+// class; an open-addressed hash table maps each tag to its way.
 class fa_cache_sim_t : public cache_sim_t
 {
  public:
-  fa_cache_sim_t(size_t ways, size_t linesz, const char* name);
+  fa_cache_sim_t(size_t ways, size_t linesz, const char* name,
+                 replacement_policy_t policy = RANDOM, prefetcher_t* prefetcher = NULL);
   uint64_t* check_tag(uint64_t addr);
   uint64_t victimize(uint64_t addr);
+  void invalidate(uint64_t addr);
  private:
-  static bool cmp(uint64_t a, uint64_t b);
-  std::map<uint64_t, uint64_t> tags;
+  size_t slot(uint64_t key);
+  void erase(uint64_t key);
+  size_t used;
+  std::vector<uint64_t> index_keys; // tag | VALID, or 0 if empty
+  std::vector<size_t> index_ways;
 };
 
 class cache_memtracer_t : public memtracer_t
@@ -99,6 +190,10 @@ class cache_memtracer_t : public memtracer_t
   {
     cache->set_log(log);
   }
+  void set_coherence(coherence_t* c)
+  {
+    cache->set_coherence(c);
+  }
 
   void printstats() {cache->print_stats();};
 
@@ -114,6 +209,10 @@ class cache_memtracer_t : public memtracer_t
    cache->write_misses = 0;
    cache->bytes_written = 0;
    cache->writebacks = 0;
+   cache->prefetches = 0;
+   cache->useful_prefetches = 0;
+   cache->late_prefetches = 0;
+   cache->useless_prefetches = 0;
   }
  protected:
   cache_sim_t* cache;
@@ -122,7 +221,7 @@ class cache_memtracer_t : public memtracer_t
 class icache_sim_t : public cache_memtracer_t
 {
  public:
-  icache_sim_t(const char* config) : cache_memtracer_t(config, "I$") {}
+  icache_sim_t(const char* config, const char* name = "I$") : cache_memtracer_t(config, name) {}
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
     return type == FETCH;
@@ -136,7 +235,7 @@ class icache_sim_t : public cache_memtracer_t
 class dcache_sim_t : public cache_memtracer_t
 {
  public:
-  dcache_sim_t(const char* config) : cache_memtracer_t(config, "D$") {}
+  dcache_sim_t(const char* config, const char* name = "D$") : cache_memtracer_t(config, name) {}
   bool interested_in_range(uint64_t begin, uint64_t end, access_type type)
   {
     return type == LOAD || type == STORE;
@@ -0,0 +1,179 @@
+// See LICENSE for license details.
+
+#include "checkpoint.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char checkpoint_magic[8] = {'S', 'P', 'I', 'K', 'E', 'C', 'K', 'P'};
+static const uint32_t checkpoint_version = 1;
+
+// Memory images start at offsets aligned for any host page size, so that a
+// checkpoint taken on one host can be mapped on another.
+static const uint64_t IMAGE_ALIGN = 1 << 16;
+// Granularity at which all-zero memory is left out of the file.
+static const size_t ZERO_CHUNK = 1 << 12;
+
+static uint64_t align_up(uint64_t x, uint64_t align)
+{
+  return (x + align - 1) & ~(align - 1);
+}
+
+static std::runtime_error io_error(const std::string& what, const std::string& path)
+{
+  return std::runtime_error(what + " " + path + ": " + strerror(errno));
+}
+
+void checkpoint_t::mismatch(const char* what)
+{
+  throw std::runtime_error(std::string("checkpoint does not match this configuration: ") + what);
+}
+
+checkpoint_writer_t::checkpoint_writer_t(const std::string& path)
+  : path(path), tmp_path(path + ".tmp"), offset(0)
+{
+  fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    throw io_error("couldn't create checkpoint", tmp_path);
+
+  char magic[sizeof(checkpoint_magic)];
+  memcpy(magic, checkpoint_magic, sizeof(magic));
+  field(magic);
+  uint32_t version = checkpoint_version;
+  field(version);
+}
+
+checkpoint_writer_t::~checkpoint_writer_t()
+{
+  if (fd >= 0) {
+    ::close(fd);
+    unlink(tmp_path.c_str());
+  }
+}
+
+void checkpoint_writer_t::flush()
+{
+  uint64_t pos = offset - buf.size();
+  for (size_t done = 0; done < buf.size(); ) {
+    ssize_t n = pwrite(fd, buf.data() + done, buf.size() - done, pos + done);
+    if (n < 0)
+      throw io_error("couldn't write checkpoint", path);
+    done += n;
+  }
+  buf.clear();
+}
+
+void checkpoint_writer_t::bytes(void* data, size_t len)
+{
+  buf.insert(buf.end(), (char*)data, (char*)data + len);
+  offset += len;
+  if (buf.size() >= IMAGE_ALIGN)
+    flush();
+}
+
+void checkpoint_writer_t::memory(char* data, size_t len)
+{
+  flush();
+  offset = align_up(offset, IMAGE_ALIGN);
+
+  static const char zero[ZERO_CHUNK] = {0};
+  for (size_t i = 0; i < len; i += ZERO_CHUNK) {
+    size_t chunk = std::min(ZERO_CHUNK, len - i);
+    if (memcmp(data + i, zero, chunk) == 0)
+      continue;
+    for (size_t done = 0; done < chunk; ) {
+      ssize_t n = pwrite(fd, data + i + done, chunk - done, offset + i + done);
+      if (n < 0)
+        throw io_error("couldn't write checkpoint", path);
+      done += n;
+    }
+  }
+
+  offset += align_up(len, IMAGE_ALIGN);
+}
+
+void checkpoint_writer_t::close()
+{
+  flush();
+  // extend the file over any trailing holes
+  if (ftruncate(fd, offset) != 0 || ::close(fd) != 0) {
+    fd = -1;
+    auto error = io_error("couldn't write checkpoint", path);
+    unlink(tmp_path.c_str());
+    throw error;
+  }
+  fd = -1;
+
+  // Replacing the file rather than truncating it leaves a checkpoint that
+  // was restored from the same path intact under its MAP_PRIVATE mapping.
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    auto error = io_error("couldn't write checkpoint", path);
+    unlink(tmp_path.c_str());
+    throw error;
+  }
+}
+
+checkpoint_reader_t::checkpoint_reader_t(const std::string& path)
+  : path(path), offset(0)
+{
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw io_error("couldn't open checkpoint", path);
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw io_error("couldn't open checkpoint", path);
+  }
+  file_size = st.st_size;
+
+  char magic[sizeof(checkpoint_magic)];
+  uint32_t version;
+  field(magic);
+  field(version);
+  if (memcmp(magic, checkpoint_magic, sizeof(magic)) != 0 || version != checkpoint_version) {
+    ::close(fd);
+    throw std::runtime_error(path + " is not a checkpoint from this version of spike");
+  }
+}
+
+checkpoint_reader_t::~checkpoint_reader_t()
+{
+  // mappings made by memory() stay valid after the file is closed
+  ::close(fd);
+}
+
+void checkpoint_reader_t::bytes(void* data, size_t len)
+{
+  if (offset + len > file_size)
+    throw std::runtime_error("checkpoint " + path + " is truncated");
+  for (size_t done = 0; done < len; ) {
+    ssize_t n = pread(fd, (char*)data + done, len - done, offset + done);
+    if (n <= 0)
+      throw io_error("couldn't read checkpoint", path);
+    done += n;
+  }
+  offset += len;
+}
+
+void checkpoint_reader_t::memory(char* data, size_t len)
+{
+  offset = align_up(offset, IMAGE_ALIGN);
+  uint64_t map_len = align_up(len, sysconf(_SC_PAGESIZE));
+  if (offset + len > file_size)
+    throw std::runtime_error("checkpoint " + path + " is truncated");
+
+  // Map the image copy-on-write in place of the current contents; pages are
+  // only read from the file when the target first touches them.
+  void* p = mmap(data, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, offset);
+  if (p == MAP_FAILED)
+    throw io_error("couldn't map checkpoint", path);
+
+  offset += align_up(len, IMAGE_ALIGN);
+}
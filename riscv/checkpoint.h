@@ -0,0 +1,83 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_CHECKPOINT_H
+#define _RISCV_CHECKPOINT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A checkpoint is a flat file holding the architectural state of a machine.
+// The same checkpoint() routine of each component is used to save and to
+// restore, so the two directions cannot drift apart: field() copies a value
+// into or out of the file, and saving() tells the few routines that need
+// different code on each side which way the data is going.
+//
+// Memory images are stored page-aligned.  All-zero pages are skipped when
+// saving (they become holes in a sparse file), and on restore the image is
+// mapped copy-on-write over the target memory, so only the pages the target
+// actually touches are read from the file.
+class checkpoint_t
+{
+ public:
+  virtual ~checkpoint_t() {}
+  virtual bool saving() const = 0;
+  virtual void bytes(void* data, size_t len) = 0;
+  // data must be page-aligned, and the host allocation must extend to the
+  // next page boundary after data + len
+  virtual void memory(char* data, size_t len) = 0;
+
+  template<class T> void field(T& value) { bytes(&value, sizeof(value)); }
+
+  // Saves value, or checks that the restored value matches it.
+  template<class T> void check(T value, const char* what)
+  {
+    T saved = value;
+    field(saved);
+    if (saved != value)
+      mismatch(what);
+  }
+
+ protected:
+  void mismatch(const char* what);
+};
+
+class checkpoint_writer_t : public checkpoint_t
+{
+ public:
+  checkpoint_writer_t(const std::string& path);
+  ~checkpoint_writer_t();
+  bool saving() const { return true; }
+  void bytes(void* data, size_t len);
+  void memory(char* data, size_t len);
+  // Flushes the file and moves it into place; errors are reported here
+  // rather than in the destructor.
+  void close();
+
+ private:
+  void flush();
+  std::string path;
+  std::string tmp_path; // written first, since path may be mapped by a restore
+  int fd;
+  uint64_t offset;
+  std::vector<char> buf;
+};
+
+class checkpoint_reader_t : public checkpoint_t
+{
+ public:
+  checkpoint_reader_t(const std::string& path);
+  ~checkpoint_reader_t();
+  bool saving() const { return false; }
+  void bytes(void* data, size_t len);
+  void memory(char* data, size_t len);
+
+ private:
+  std::string path;
+  int fd;
+  uint64_t offset;
+  uint64_t file_size;
+};
+
+#endif
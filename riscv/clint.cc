@@ -1,5 +1,6 @@
 #include "devices.h"
 #include "processor.h"
+#include "checkpoint.h"
 
 clint_t::clint_t(std::vector<processor_t*>& procs)
   : procs(procs), mtime(0), mtimecmp(procs.size())
@@ -46,9 +47,7 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
     memset((uint8_t*)&mask[0] + addr - MSIP_BASE, 0xff, len);
     for (size_t i = 0; i < procs.size(); ++i) {
       if (!(mask[i] & 0xFF)) continue;
-      procs[i]->state.mip &= ~MIP_MSIP;
-      if (!!(msip[i] & 1))
-        procs[i]->state.mip |= MIP_MSIP;
+      set_mip(procs[i], MIP_MSIP, msip[i] & 1);
     }
   } else if (addr >= MTIMECMP_BASE && addr + len <= MTIMECMP_BASE + procs.size()*sizeof(mtimecmp_t)) {
     memcpy((uint8_t*)&mtimecmp[0] + addr - MTIMECMP_BASE, bytes, len);
@@ -64,9 +63,24 @@ bool clint_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 void clint_t::increment(reg_t inc)
 {
   mtime += inc;
-  for (size_t i = 0; i < procs.size(); i++) {
-    procs[i]->state.mip &= ~MIP_MTIP;
-    if (mtime >= mtimecmp[i])
-      procs[i]->state.mip |= MIP_MTIP;
-  }
+  for (size_t i = 0; i < procs.size(); i++)
+    set_mip(procs[i], MIP_MTIP, mtime >= mtimecmp[i]);
+}
+
+// The target hart may be running on another host thread, and updates its
+// own mip bits concurrently, so update the bit atomically.
+void clint_t::set_mip(processor_t* proc, reg_t bit, bool value)
+{
+  if (value)
+    __atomic_fetch_or(&proc->state.mip, bit, __ATOMIC_RELAXED);
+  else
+    __atomic_fetch_and(&proc->state.mip, ~bit, __ATOMIC_RELAXED);
+}
+
+void clint_t::checkpoint(checkpoint_t& cp)
+{
+  cp.check(mtimecmp.size(), "number of harts");
+  cp.field(mtime);
+  for (auto& cmp : mtimecmp)
+    cp.field(cmp);
 }
@@ -0,0 +1,157 @@
+// See LICENSE for license details.
+
+#include "coherence.h"
+#include "cachesim.h"
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <stdexcept>
+
+coherence_t::~coherence_t()
+{
+  print_stats();
+}
+
+size_t coherence_t::add(cache_sim_t* cache)
+{
+  if (linesz && cache->linesz != linesz)
+    throw std::runtime_error("coherent caches must have the same block size");
+  linesz = cache->linesz;
+  caches.push_back(cache);
+  lost.resize(caches.size());
+  return caches.size() - 1;
+}
+
+// the bytes of a line that an access touches, one bit for each 64th of it
+uint64_t coherence_t::byte_mask(uint64_t addr, size_t bytes)
+{
+  size_t grain = std::max<size_t>(linesz / 64, 1);
+  size_t first = (addr & (linesz - 1)) / grain;
+  size_t last = std::min<size_t>((addr & (linesz - 1)) + std::max<size_t>(bytes, 1) - 1,
+                                 linesz - 1) / grain;
+  uint64_t upto_last = last == 63 ? ~uint64_t(0) : (uint64_t(1) << (last + 1)) - 1;
+  return upto_last & ~((uint64_t(1) << first) - 1);
+}
+
+void coherence_t::demand_miss(size_t id, uint64_t addr, size_t bytes)
+{
+  auto it = lost[id].find(line_of(addr));
+  if (it == lost[id].end())
+    return;
+
+  line_stats_t& line = lines[it->first];
+  line.lost--;
+  line.coherence_misses++;
+  coherence_misses++;
+  if (!(it->second & byte_mask(addr, bytes))) {
+    line.false_sharing_misses++;
+    false_sharing_misses++;
+  }
+  lost[id].erase(it);
+}
+
+void coherence_t::invalidate_others(size_t id, uint64_t addr)
+{
+  for (size_t i = 0; i < caches.size(); i++) {
+    cache_sim_t* c = caches[i];
+    uint64_t* tag = i == id ? NULL : c->check_tag(addr);
+    if (!tag)
+      continue;
+    // a modified line goes to the new owner rather than the next level
+    c->invalidate(addr);
+    invalidations++;
+    line_stats_t& line = lines[line_of(addr)];
+    line.invalidations++;
+    if (lost[i].insert(std::make_pair(line_of(addr), uint64_t(0))).second)
+      line.lost++;
+  }
+}
+
+void coherence_t::fetch(size_t id, uint64_t addr, bool store, bool* shared, bool* supplied)
+{
+  *shared = *supplied = false;
+  for (size_t i = 0; i < caches.size(); i++) {
+    uint64_t* tag = i == id ? NULL : caches[i]->check_tag(addr);
+    if (!tag)
+      continue;
+    *supplied = true;
+    if (store)
+      continue;
+
+    // M and E copies become S; a modified line is written back on the way
+    cache_sim_t* c = caches[i];
+    if (*tag & cache_sim_t::EXCLUSIVE)
+      downgrades++;
+    if (*tag & cache_sim_t::DIRTY) {
+      if (c->miss_handler)
+        c->miss_handler->access(line_of(addr), linesz, true);
+      c->writebacks++;
+    }
+    *tag &= ~(cache_sim_t::EXCLUSIVE | cache_sim_t::DIRTY);
+    *shared = true;
+  }
+
+  if (*supplied)
+    transfers++;
+  if (store)
+    invalidate_others(id, addr);
+}
+
+void coherence_t::upgrade(size_t id, uint64_t addr)
+{
+  upgrades++;
+  invalidate_others(id, addr);
+}
+
+void coherence_t::store(size_t id, uint64_t addr, size_t bytes)
+{
+  auto it = lines.find(line_of(addr));
+  if (it == lines.end() || it->second.lost == 0)
+    return;
+
+  uint64_t mask = byte_mask(addr, bytes);
+  for (size_t i = 0; i < caches.size(); i++) {
+    if (i == id)
+      continue;
+    auto l = lost[i].find(it->first);
+    if (l != lost[i].end())
+      l->second |= mask;
+  }
+}
+
+void coherence_t::print_stats()
+{
+  std::cout << "Coherence Invalidations:   " << invalidations << std::endl;
+  std::cout << "Coherence Upgrades:        " << upgrades << std::endl;
+  std::cout << "Coherence Downgrades:      " << downgrades << std::endl;
+  std::cout << "Cache-to-Cache Transfers:  " << transfers << std::endl;
+  std::cout << "Coherence Misses:          " << coherence_misses << std::endl;
+  std::cout << "False Sharing Misses:      " << false_sharing_misses << std::endl;
+
+  std::vector<std::pair<uint64_t, line_stats_t>> hot;
+  for (auto& l : lines)
+    if (l.second.coherence_misses)
+      hot.push_back(l);
+  auto hotter = [](const std::pair<uint64_t, line_stats_t>& a,
+                   const std::pair<uint64_t, line_stats_t>& b) {
+    if (a.second.coherence_misses != b.second.coherence_misses)
+      return a.second.coherence_misses > b.second.coherence_misses;
+    return a.first < b.first;
+  };
+  size_t n = std::min(hot.size(), HOT_LINES);
+  std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), hotter);
+  if (n == 0)
+    return;
+
+  std::cout << "Lines with the most coherence misses:" << std::endl;
+  std::cout << "  " << std::setw(18) << std::left << "Address" << std::right
+            << std::setw(14) << "Misses" << std::setw(14) << "False Sharing"
+            << std::setw(15) << "Invalidations" << std::endl;
+  for (size_t i = 0; i < n; i++) {
+    std::cout << "  0x" << std::hex << std::setw(16) << std::setfill('0') << hot[i].first
+              << std::dec << std::setfill(' ')
+              << std::setw(14) << hot[i].second.coherence_misses
+              << std::setw(14) << hot[i].second.false_sharing_misses
+              << std::setw(15) << hot[i].second.invalidations << std::endl;
+  }
+}
@@ -0,0 +1,72 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COHERENCE_H
+#define _RISCV_COHERENCE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+class cache_sim_t;
+
+// Keeps the private caches of several harts coherent with a snooping MESI
+// protocol. A miss looks for the line in the other caches: a load takes it
+// shared from them, writing it back first if it was modified, while a store
+// invalidates every other copy. Either way a cache holding the line
+// supplies it, so the next level is only read when none does.
+//
+// A miss on a line that was lost to an invalidation is a coherence miss. It
+// is a false-sharing miss if no byte it accesses has been written by
+// another hart since.
+class coherence_t
+{
+ public:
+  coherence_t() : linesz(0), invalidations(0), upgrades(0), downgrades(0),
+                  transfers(0), coherence_misses(0), false_sharing_misses(0) {}
+  ~coherence_t();
+
+  // returns the id by which the cache refers to itself
+  size_t add(cache_sim_t* cache);
+
+  // cache id missed on addr: classify the miss
+  void demand_miss(size_t id, uint64_t addr, size_t bytes);
+  // cache id is about to fill addr's line: snoop the other caches
+  void fetch(size_t id, uint64_t addr, bool store, bool* shared, bool* supplied);
+  // cache id stores to a line it holds shared: invalidate the other copies
+  void upgrade(size_t id, uint64_t addr);
+  // cache id has stored to a line it holds exclusively
+  void store(size_t id, uint64_t addr, size_t bytes);
+
+  void print_stats();
+
+ private:
+  static const size_t HOT_LINES = 16;
+
+  struct line_stats_t {
+    uint64_t invalidations;
+    uint64_t coherence_misses;
+    uint64_t false_sharing_misses;
+    size_t lost; // caches that have lost the line and not missed on it since
+  };
+
+  uint64_t line_of(uint64_t addr) { return addr & ~uint64_t(linesz - 1); }
+  uint64_t byte_mask(uint64_t addr, size_t bytes);
+  void invalidate_others(size_t id, uint64_t addr);
+
+  size_t linesz;
+  std::vector<cache_sim_t*> caches;
+  std::unordered_map<uint64_t, line_stats_t> lines;
+  // for each cache, the lines it has lost to invalidation, with the bytes
+  // other harts have written to them since
+  std::vector<std::unordered_map<uint64_t, uint64_t>> lost;
+
+  uint64_t invalidations;
+  uint64_t upgrades;
+  uint64_t downgrades;
+  uint64_t transfers;
+  uint64_t coherence_misses;
+  uint64_t false_sharing_misses;
+};
+
+#endif
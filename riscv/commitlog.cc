@@ -0,0 +1,98 @@
+// See LICENSE for license details.
+
+#include "commitlog.h"
+#include <cinttypes>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <string>
+
+void commit_log_print_value(FILE* out, int width, const void* data)
+{
+  const uint64_t *arr = (const uint64_t *)data;
+
+  fprintf(out, "0x");
+  for (int idx = width / 64 - 1; idx >= 0; --idx) {
+    fprintf(out, "%016" PRIx64, arr[idx]);
+  }
+}
+
+void commit_log_print_value(FILE* out, int width, uint64_t hi, uint64_t lo)
+{
+  switch (width) {
+    case 8:
+      fprintf(out, "0x%01" PRIx8, (uint8_t)lo);
+      break;
+    case 16:
+      fprintf(out, "0x%04" PRIx16, (uint16_t)lo);
+      break;
+    case 32:
+      fprintf(out, "0x%08" PRIx32, (uint32_t)lo);
+      break;
+    case 64:
+      fprintf(out, "0x%016" PRIx64, lo);
+      break;
+    case 128:
+      fprintf(out, "0x%016" PRIx64 "%016" PRIx64, hi, lo);
+      break;
+    default:
+      abort();
+  }
+}
+
+commit_trace_t::commit_trace_t(const char* path)
+  : ring(RING_BUFFERS), head(0), count(0), exiting(false)
+{
+  file = fopen(path, "wb");
+  if (!file)
+    throw std::runtime_error(std::string("couldn't open commit trace ") + path + ": " + strerror(errno));
+  fwrite(COMMIT_TRACE_MAGIC, 1, strlen(COMMIT_TRACE_MAGIC), file);
+  writer = std::thread(&commit_trace_t::writer_main, this);
+}
+
+commit_trace_t::~commit_trace_t()
+{
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    exiting = true;
+  }
+  ring_filled.notify_one();
+  writer.join();
+  fclose(file);
+}
+
+void commit_trace_t::submit(std::vector<char>& buf)
+{
+  std::unique_lock<std::mutex> guard(lock);
+  ring_drained.wait(guard, [&]{ return count < ring.size(); });
+  // the slot holds an already-written buffer, which is handed back for reuse
+  buf.swap(ring[(head + count) % ring.size()]);
+  count++;
+  guard.unlock();
+  ring_filled.notify_one();
+  buf.clear();
+}
+
+void commit_trace_t::writer_main()
+{
+  std::vector<char> buf;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      ring_filled.wait(guard, [&]{ return exiting || count > 0; });
+      if (count == 0)
+        return;
+      buf.swap(ring[head]);
+      head = (head + 1) % ring.size();
+      count--;
+    }
+    ring_drained.notify_one();
+
+    if (fwrite(buf.data(), 1, buf.size(), file) != buf.size()) {
+      fprintf(stderr, "error writing commit trace: %s\n", strerror(errno));
+      abort();
+    }
+    buf.clear();
+  }
+}
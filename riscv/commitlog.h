@@ -0,0 +1,75 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_COMMITLOG_H
+#define _RISCV_COMMITLOG_H
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Binary commit log.  Each retired instruction is stored as a fixed-size
+// commit_trace_insn_t, followed by
+//   nregs   register writes: a commit_trace_reg_t and then its value, which
+//           is 16 bytes for x and f registers and width/8 bytes for v ones
+//   nloads  load addresses (8 bytes each)
+//   nstores stores: address (8 bytes), value (8 bytes) and size (1 byte)
+// All fields are in host byte order.  spike-commit-decode turns a trace
+// back into the text format printed by --log-commits.
+
+#define COMMIT_TRACE_MAGIC "SPIKECT1"
+
+struct commit_trace_insn_t {
+  uint64_t pc;
+  uint64_t bits;
+  uint8_t priv;
+  uint8_t xlen;
+  uint8_t flen;
+  uint8_t nregs;
+  uint16_t nloads;
+  uint16_t nstores;
+};
+
+struct commit_trace_reg_t {
+  uint16_t key;   // (regnum << 2) | (0: x, 1: f, 2: v)
+  uint16_t width; // in bits
+  uint8_t vsew;   // SEW in bytes and LMUL, for vector registers
+  uint8_t vlmul;
+  uint16_t reserved;
+};
+
+void commit_log_print_value(FILE* out, int width, const void* data);
+void commit_log_print_value(FILE* out, int width, uint64_t hi, uint64_t lo);
+
+// Writes trace records to a file on a background thread.  Harts fill their
+// own buffers and hand them over whole, so the simulation only waits for
+// the disk when the ring of pending buffers is full.
+class commit_trace_t
+{
+ public:
+  static const size_t BUFFER_SIZE = 1 << 20;
+  static const size_t RING_BUFFERS = 64;
+
+  commit_trace_t(const char* path);
+  ~commit_trace_t();
+
+  // Queues the contents of buf for writing and replaces it with an empty
+  // buffer.
+  void submit(std::vector<char>& buf);
+
+ private:
+  void writer_main();
+
+  FILE* file;
+  std::vector<std::vector<char>> ring;
+  size_t head, count;
+  bool exiting;
+  std::mutex lock;
+  std::condition_variable ring_filled;
+  std::condition_variable ring_drained;
+  std::thread writer;
+};
+
+#endif
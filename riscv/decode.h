@@ -251,7 +251,8 @@ private:
     */
 # define WRITE_REG(reg, value) ({ \
     reg_t wdata = (value); /* value may have side effects */ \
-    STATE.log_reg_write[(reg) << 2] = {wdata, 0}; \
+    if (p->get_log_commits()) \
+      STATE.log_reg_write[(reg) << 2] = {wdata, 0}; \
     STATE.XPR.write(reg, wdata); \
     if (p->rvfi_dii && reg) { \
       p->rvfi_dii_output.rvfi_dii_rd_wdata = wdata; \
@@ -260,7 +261,8 @@ private:
   })
 # define WRITE_FREG(reg, value) ({ \
     freg_t wdata = freg(value); /* value may have side effects */ \
-    STATE.log_reg_write[((reg) << 2) | 1] = wdata; \
+    if (p->get_log_commits()) \
+      STATE.log_reg_write[((reg) << 2) | 1] = wdata; \
     DO_WRITE_FREG(reg, wdata); \
   })
 #endif
@@ -357,20 +359,22 @@ private:
        STATE.pc = __npc; \
      } while(0)
 
-class wait_for_interrupt_t {};
-
 #define wfi() \
   do { set_pc_and_serialize(npc); \
        npc = TO_ARCH_PC(PC_SERIALIZE_WFI); \
-       throw wait_for_interrupt_t(); \
      } while(0)
 
+// Takes trap t without unwinding: the instruction returns PC_TRAP, and
+// processor_t::step delivers the trap recorded by defer_trap.
+#define return_trap(t) return p->defer_trap(t)
+
 #define serialize() set_pc_and_serialize(npc)
 
 /* Sentinel PC values to serialize simulator pipeline */
 #define PC_SERIALIZE_BEFORE 3
 #define PC_SERIALIZE_AFTER 5
 #define PC_SERIALIZE_WFI 7
+#define PC_TRAP 9
 #define invalid_pc(pc) ((pc) & 1)
 
 /* Convenience wrappers to simplify softfloat code sequences */
@@ -686,6 +690,160 @@ static inline bool is_overlapped(const int astart, const int asize,
     } \
   } while (0)
 
+//
+// vector: unmasked fast path
+//
+// Integer operations that start at element 0 and are not masked run as
+// plain loops over the register file instead of going through elt(). The
+// loops work on fixed-size chunks with no dependences between elements,
+// which the compiler turns into host SIMD code.
+#ifdef WORDS_BIGENDIAN
+#define VI_FAST_PATH false
+#else
+#define VI_FAST_PATH (P.VU.vstart == 0 && insn.v_vm() == 1)
+#endif
+
+#if defined(__clang__)
+#define VI_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define VI_IVDEP _Pragma("GCC ivdep")
+#else
+#define VI_IVDEP
+#endif
+
+#define VI_FAST_CHUNK_BYTES 32
+
+#define VI_FAST_LOOP_BASE \
+  require(P.VU.vsew == e8 || P.VU.vsew == e16 || P.VU.vsew == e32 || P.VU.vsew == e64); \
+  require_vector;\
+  reg_t vl = P.VU.vl; \
+  reg_t sew = P.VU.vsew; \
+  reg_t rd_num = insn.rd(); \
+  reg_t rs1_num = insn.rs1(); \
+  reg_t rs2_num = insn.rs2();
+
+// runs BODY for elements 0..vl-1 of SEW x
+#define VI_FAST_LOOP(x, BODY) \
+  { \
+    const reg_t chunk = VI_FAST_CHUNK_BYTES / (x / 8); \
+    reg_t i0 = 0; \
+    for (; i0 + chunk <= vl; i0 += chunk) { \
+      VI_IVDEP \
+      for (reg_t i = i0; i < i0 + chunk; ++i) { BODY; } \
+    } \
+    for (reg_t i = i0; i < vl; ++i) { BODY; } \
+  }
+
+#define VI_FAST_SEW_DISPATCH(LOOP, TYPE, BODY) \
+  if (sew == e8) { \
+    LOOP(e8, TYPE<e8>::type, BODY) \
+  } else if (sew == e16) { \
+    LOOP(e16, TYPE<e16>::type, BODY) \
+  } else if (sew == e32) { \
+    LOOP(e32, TYPE<e32>::type, BODY) \
+  } else if (sew == e64) { \
+    LOOP(e64, TYPE<e64>::type, BODY) \
+  }
+
+#define VV_FAST_LOOP(x, type, BODY) \
+  { \
+    type *vd_p = P.VU.elt_group<type>(rd_num, vl, true); \
+    type *vs1_p = P.VU.elt_group<type>(rs1_num, vl); \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    VI_FAST_LOOP(x, type &vd = vd_p[i]; type vs1 = vs1_p[i]; type vs2 = vs2_p[i]; BODY) \
+  }
+
+#define VX_FAST_LOOP(x, type, BODY) \
+  { \
+    type *vd_p = P.VU.elt_group<type>(rd_num, vl, true); \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    type rs1 = (type)RS1; \
+    VI_FAST_LOOP(x, type &vd = vd_p[i]; type vs2 = vs2_p[i]; BODY) \
+  }
+
+#define VI_FAST_LOOP_SIMM5(x, type, BODY) \
+  { \
+    type *vd_p = P.VU.elt_group<type>(rd_num, vl, true); \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    type simm5 = (type)insn.v_simm5(); \
+    VI_FAST_LOOP(x, type &vd = vd_p[i]; type vs2 = vs2_p[i]; BODY) \
+  }
+
+#define VI_FAST_LOOP_ZIMM5(x, type, BODY) \
+  { \
+    type *vd_p = P.VU.elt_group<type>(rd_num, vl, true); \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    type simm5 = (type)insn.v_zimm5(); \
+    VI_FAST_LOOP(x, type &vd = vd_p[i]; type vs2 = vs2_p[i]; BODY) \
+  }
+
+// Comparisons pack one result per mlen-bit field of the mask register,
+// a 64-bit word at a time; fields past vl are left alone.
+#define VI_FAST_CMP_LOOP(x, type, OPERANDS, BODY) \
+  { \
+    const reg_t mlen = P.VU.vmlen; \
+    const reg_t per_word = 64 / mlen; \
+    uint64_t *vdw = P.VU.elt_group<uint64_t>(rd_num, (vl + per_word - 1) / per_word, true); \
+    for (reg_t i0 = 0; i0 < vl; i0 += per_word) { \
+      reg_t n = std::min(per_word, vl - i0); \
+      uint64_t bits = 0; \
+      for (reg_t i = i0; i < i0 + n; ++i) { \
+        OPERANDS; \
+        uint64_t res = 0; \
+        BODY; \
+        bits |= (res & 1) << ((i - i0) * mlen); \
+      } \
+      uint64_t mmask = n * mlen == 64 ? UINT64_MAX : (UINT64_C(1) << (n * mlen)) - 1; \
+      vdw[i0 / per_word] = (vdw[i0 / per_word] & ~mmask) | bits; \
+    } \
+  }
+
+#define VV_FAST_CMP_LOOP(x, type, BODY) \
+  { \
+    type *vs1_p = P.VU.elt_group<type>(rs1_num, vl); \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    VI_FAST_CMP_LOOP(x, type, type vs1 = vs1_p[i]; type vs2 = vs2_p[i], BODY) \
+  }
+
+#define VX_FAST_CMP_LOOP(x, type, BODY) \
+  { \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    type rs1 = (type)RS1; \
+    VI_FAST_CMP_LOOP(x, type, type vs2 = vs2_p[i], BODY) \
+  }
+
+#define VI_FAST_CMP_LOOP_SIMM5(x, type, BODY) \
+  { \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    type simm5 = (type)insn.v_simm5(); \
+    VI_FAST_CMP_LOOP(x, type, type vs2 = vs2_p[i], BODY) \
+  }
+
+#define VI_FAST_CMP_LOOP_ZIMM5(x, type, BODY) \
+  { \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    type simm5 = (type)insn.v_zimm5(); \
+    VI_FAST_CMP_LOOP(x, type, type vs2 = vs2_p[i], BODY) \
+  }
+
+#define VI_FAST_REDUCTION_LOOP(x, type, BODY) \
+  { \
+    reg_t vl = P.VU.vl; \
+    reg_t rd_num = insn.rd(); \
+    reg_t rs1_num = insn.rs1(); \
+    reg_t rs2_num = insn.rs2(); \
+    auto &vd_0_des = P.VU.elt<type>(rd_num, 0, true); \
+    auto vd_0_res = P.VU.elt<type>(rs1_num, 0); \
+    type *vs2_p = P.VU.elt_group<type>(rs2_num, vl); \
+    for (reg_t i = 0; i < vl; ++i) { \
+      type vs2 = vs2_p[i]; \
+      BODY; \
+    } \
+    if (vl > 0) { \
+      vd_0_des = vd_0_res; \
+    } \
+  }
+
 //
 // vector: integer and masking operand access helper
 //
@@ -785,111 +943,141 @@ static inline bool is_overlapped(const int astart, const int asize,
 // comparision result to masking register
 #define VI_VV_LOOP_CMP(BODY) \
   VI_CHECK_MSS(true); \
-  VI_LOOP_CMP_BASE \
-  if (sew == e8){ \
-    VV_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VV_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VV_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VV_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_CMP_END
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VV_FAST_CMP_LOOP, type_sew_t, BODY) \
+  } else { \
+    VI_LOOP_CMP_BASE \
+    if (sew == e8){ \
+      VV_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VV_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VV_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VV_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_CMP_END \
+  }
 
 #define VI_VX_LOOP_CMP(BODY) \
   VI_CHECK_MSS(false); \
-  VI_LOOP_CMP_BASE \
-  if (sew == e8){ \
-    VX_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VX_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VX_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VX_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_CMP_END
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VX_FAST_CMP_LOOP, type_sew_t, BODY) \
+  } else { \
+    VI_LOOP_CMP_BASE \
+    if (sew == e8){ \
+      VX_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VX_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VX_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VX_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_CMP_END \
+  }
 
 #define VI_VI_LOOP_CMP(BODY) \
   VI_CHECK_MSS(false); \
-  VI_LOOP_CMP_BASE \
-  if (sew == e8){ \
-    VI_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VI_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VI_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VI_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_CMP_END
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VI_FAST_CMP_LOOP_SIMM5, type_sew_t, BODY) \
+  } else { \
+    VI_LOOP_CMP_BASE \
+    if (sew == e8){ \
+      VI_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VI_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VI_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VI_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_CMP_END \
+  }
 
 #define VI_VV_ULOOP_CMP(BODY) \
   VI_CHECK_MSS(true); \
-  VI_LOOP_CMP_BASE \
-  if (sew == e8){ \
-    VV_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VV_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VV_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VV_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_CMP_END
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VV_FAST_CMP_LOOP, type_usew_t, BODY) \
+  } else { \
+    VI_LOOP_CMP_BASE \
+    if (sew == e8){ \
+      VV_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VV_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VV_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VV_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_CMP_END \
+  }
 
 #define VI_VX_ULOOP_CMP(BODY) \
   VI_CHECK_MSS(false); \
-  VI_LOOP_CMP_BASE \
-  if (sew == e8){ \
-    VX_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VX_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VX_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VX_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_CMP_END
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VX_FAST_CMP_LOOP, type_usew_t, BODY) \
+  } else { \
+    VI_LOOP_CMP_BASE \
+    if (sew == e8){ \
+      VX_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VX_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VX_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VX_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_CMP_END \
+  }
 
 #define VI_VI_ULOOP_CMP(BODY) \
   VI_CHECK_MSS(false); \
-  VI_LOOP_CMP_BASE \
-  if (sew == e8){ \
-    VI_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VI_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VI_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VI_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_CMP_END
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VI_FAST_CMP_LOOP_ZIMM5, type_usew_t, BODY) \
+  } else { \
+    VI_LOOP_CMP_BASE \
+    if (sew == e8){ \
+      VI_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VI_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VI_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VI_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_CMP_END \
+  }
 
 // merge and copy loop
 #define VI_VVXI_MERGE_LOOP(BODY) \
@@ -924,9 +1112,13 @@ static inline bool is_overlapped(const int astart, const int asize,
     auto vs2 = P.VU.elt<type_sew_t<x>::type>(rs2_num, i); \
 
 #define REDUCTION_LOOP(x, BODY) \
-  VI_LOOP_REDUCTION_BASE(x) \
-  BODY; \
-  VI_LOOP_REDUCTION_END(x)
+  if (VI_FAST_PATH) { \
+    VI_FAST_REDUCTION_LOOP(x, type_sew_t<x>::type, BODY) \
+  } else { \
+    VI_LOOP_REDUCTION_BASE(x) \
+    BODY; \
+    VI_LOOP_REDUCTION_END(x) \
+  }
 
 #define VI_VV_LOOP_REDUCTION(BODY) \
   VI_CHECK_REDUCTION(false); \
@@ -955,9 +1147,13 @@ static inline bool is_overlapped(const int astart, const int asize,
     auto vs2 = P.VU.elt<type_usew_t<x>::type>(rs2_num, i);
 
 #define REDUCTION_ULOOP(x, BODY) \
-  VI_ULOOP_REDUCTION_BASE(x) \
-  BODY; \
-  VI_LOOP_REDUCTION_END(x)
+  if (VI_FAST_PATH) { \
+    VI_FAST_REDUCTION_LOOP(x, type_usew_t<x>::type, BODY) \
+  } else { \
+    VI_ULOOP_REDUCTION_BASE(x) \
+    BODY; \
+    VI_LOOP_REDUCTION_END(x) \
+  }
 
 #define VI_VV_ULOOP_REDUCTION(BODY) \
   VI_CHECK_REDUCTION(false); \
@@ -973,113 +1169,161 @@ static inline bool is_overlapped(const int astart, const int asize,
   }
 
 // genearl VXI signed/unsgied loop
-#define VI_VV_ULOOP(BODY) \
+#define VI_VV_ULOOP_IF(FAST, BODY) \
   VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VV_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VV_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VV_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VV_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (FAST) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VV_FAST_LOOP, type_usew_t, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VV_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VV_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VV_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VV_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
+
+#define VI_VV_ULOOP(BODY) VI_VV_ULOOP_IF(VI_FAST_PATH, BODY)
 
-#define VI_VV_LOOP(BODY) \
+#define VI_VV_LOOP_IF(FAST, BODY) \
   VI_CHECK_SSS(true) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VV_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VV_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VV_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VV_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (FAST) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VV_FAST_LOOP, type_sew_t, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VV_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VV_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VV_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VV_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
-#define VI_VX_ULOOP(BODY) \
+#define VI_VV_LOOP(BODY) VI_VV_LOOP_IF(VI_FAST_PATH, BODY)
+
+#define VI_VX_ULOOP_IF(FAST, BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VX_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VX_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VX_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VX_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (FAST) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VX_FAST_LOOP, type_usew_t, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VX_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VX_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VX_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VX_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
+
+#define VI_VX_ULOOP(BODY) VI_VX_ULOOP_IF(VI_FAST_PATH, BODY)
 
-#define VI_VX_LOOP(BODY) \
+#define VI_VX_LOOP_IF(FAST, BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VX_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VX_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VX_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VX_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (FAST) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VX_FAST_LOOP, type_sew_t, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VX_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VX_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VX_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VX_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
+
+#define VI_VX_LOOP(BODY) VI_VX_LOOP_IF(VI_FAST_PATH, BODY)
 
-#define VI_VI_ULOOP(BODY) \
+#define VI_VI_ULOOP_IF(FAST, BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VI_U_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VI_U_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VI_U_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VI_U_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (FAST) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VI_FAST_LOOP_ZIMM5, type_usew_t, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VI_U_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VI_U_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VI_U_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VI_U_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
+
+#define VI_VI_ULOOP(BODY) VI_VI_ULOOP_IF(VI_FAST_PATH, BODY)
+
+// Saturating instructions update vxsat from every element, a dependence the
+// ivdep fast loops would hide from the compiler, so they never take them.
+#define VI_VV_ULOOP_SAT(BODY) VI_VV_ULOOP_IF(false, BODY)
+#define VI_VV_LOOP_SAT(BODY) VI_VV_LOOP_IF(false, BODY)
+#define VI_VX_ULOOP_SAT(BODY) VI_VX_ULOOP_IF(false, BODY)
+#define VI_VX_LOOP_SAT(BODY) VI_VX_LOOP_IF(false, BODY)
+#define VI_VI_ULOOP_SAT(BODY) VI_VI_ULOOP_IF(false, BODY)
 
 #define VI_VI_LOOP(BODY) \
   VI_CHECK_SSS(false) \
-  VI_LOOP_BASE \
-  if (sew == e8){ \
-    VI_PARAMS(e8); \
-    BODY; \
-  }else if(sew == e16){ \
-    VI_PARAMS(e16); \
-    BODY; \
-  }else if(sew == e32){ \
-    VI_PARAMS(e32); \
-    BODY; \
-  }else if(sew == e64){ \
-    VI_PARAMS(e64); \
-    BODY; \
-  } \
-  VI_LOOP_END 
+  if (VI_FAST_PATH) { \
+    VI_FAST_LOOP_BASE \
+    VI_FAST_SEW_DISPATCH(VI_FAST_LOOP_SIMM5, type_sew_t, BODY) \
+  } else { \
+    VI_LOOP_BASE \
+    if (sew == e8){ \
+      VI_PARAMS(e8); \
+      BODY; \
+    }else if(sew == e16){ \
+      VI_PARAMS(e16); \
+      BODY; \
+    }else if(sew == e32){ \
+      VI_PARAMS(e32); \
+      BODY; \
+    }else if(sew == e64){ \
+      VI_PARAMS(e64); \
+      BODY; \
+    } \
+    VI_LOOP_END \
+  }
 
 // narrow operation loop
 #define VI_VV_LOOP_NARROW(BODY) \
@@ -1565,7 +1809,39 @@ for (reg_t i = 0; i < vlmax; ++i) { \
   } \
 }
 
-#define VI_ST_COMMON(stride, offset, st_width, elt_byte) \
+// Vector loads and stores translate once per page: the first element on a
+// page goes through MMU.load_*/store_*, which takes any fault and refills
+// the TLB, and later elements on that page use MMU.direct_page().  An
+// unmasked unit-stride access whose memory elements are SEW wide copies the
+// rest of each page between memory and the register file in one go.
+#define VI_DIRECT_VARS \
+  char *direct_host = NULL; \
+  reg_t direct_vaddr = 0;
+
+#define VI_DIRECT_HIT(addr, elt_byte) \
+  (direct_host && (((addr) ^ direct_vaddr) & PGMASK) == 0 && \
+   ((addr) & ((elt_byte) - 1)) == 0)
+
+#define VI_DIRECT_REFILL(addr, type) \
+  direct_host = MMU.direct_page(addr, type); \
+  direct_vaddr = addr;
+
+#ifdef WORDS_BIGENDIAN
+#define VI_LDST_BULK(unit_stride, elt_byte) false
+#else
+#define VI_LDST_BULK(unit_stride, elt_byte) \
+  ((unit_stride) && nf == 1 && insn.v_vm() == 1 && P.VU.vstart == 0 && \
+   (elt_byte) * 8 == P.VU.vsew && \
+   (vlmul == 1 || P.VU.get_slen() == P.VU.get_vlen()))
+#endif
+
+// number of elements after element i that a bulk copy can move, all of
+// which lie on the page last translated
+#define VI_LDST_BULK_RUN(elt_byte) \
+  (VI_DIRECT_HIT(baseAddr + (i + 1) * (elt_byte), elt_byte) ? \
+   std::min(vl - i - 1, (PGSIZE - ((baseAddr + (i + 1) * (elt_byte)) & ~PGMASK)) / (elt_byte)) : 0)
+
+#define VI_ST_COMMON(stride, offset, st_width, elt_byte, unit_stride) \
   const reg_t nf = insn.v_nf() + 1; \
   require((nf * P.VU.vlmul) <= (NVPR / 4)); \
   const reg_t vl = P.VU.vl; \
@@ -1573,6 +1849,8 @@ for (reg_t i = 0; i < vlmax; ++i) { \
   const reg_t vs3 = insn.rd(); \
   require(vs3 + nf * P.VU.vlmul <= NVPR); \
   const reg_t vlmul = P.VU.vlmul; \
+  const bool bulk = VI_LDST_BULK(unit_stride, elt_byte); \
+  VI_DIRECT_VARS \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_STRIP(i) \
     VI_ELEMENT_SKIP(i); \
@@ -1593,12 +1871,27 @@ for (reg_t i = 0; i < vlmax; ++i) { \
         val = P.VU.elt<uint64_t>(vs3 + fn * vlmul, vreg_inx); \
         break; \
       } \
-      MMU.store_##st_width(baseAddr + (stride) + (offset) * elt_byte, val); \
+      const reg_t addr = baseAddr + (stride) + (offset) * elt_byte; \
+      if (VI_DIRECT_HIT(addr, elt_byte)) { \
+        MMU.log_direct_stores(addr, 1, &val); \
+        *(st_width##_t*)(direct_host + (addr & ~PGMASK)) = to_le(val); \
+      } else { \
+        MMU.store_##st_width(addr, val); \
+        VI_DIRECT_REFILL(addr, STORE); \
+      } \
+    } \
+    const reg_t n = bulk ? VI_LDST_BULK_RUN(elt_byte) : 0; \
+    if (n > 0) { \
+      const reg_t addr = baseAddr + (i + 1) * elt_byte; \
+      const st_width##_t *src = P.VU.elt_group<st_width##_t>(vs3, vl) + i + 1; \
+      MMU.log_direct_stores(addr, n, src); \
+      memcpy(direct_host + (addr & ~PGMASK), src, n * elt_byte); \
+      i += n; \
     } \
   } \
   P.VU.vstart = 0; 
 
-#define VI_LD_COMMON(stride, offset, ld_width, elt_byte) \
+#define VI_LD_COMMON(stride, offset, ld_width, elt_byte, unit_stride) \
   const reg_t nf = insn.v_nf() + 1; \
   require((nf * P.VU.vlmul) <= (NVPR / 4)); \
   const reg_t vl = P.VU.vl; \
@@ -1606,12 +1899,22 @@ for (reg_t i = 0; i < vlmax; ++i) { \
   const reg_t vd = insn.rd(); \
   require(vd + nf * P.VU.vlmul <= NVPR); \
   const reg_t vlmul = P.VU.vlmul; \
+  const bool bulk = VI_LDST_BULK(unit_stride, elt_byte); \
+  VI_DIRECT_VARS \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_ELEMENT_SKIP(i); \
     VI_STRIP(i); \
     P.VU.vstart = i; \
     for (reg_t fn = 0; fn < nf; ++fn) { \
-      ld_width##_t val = MMU.load_##ld_width(baseAddr + (stride) + (offset) * elt_byte); \
+      const reg_t addr = baseAddr + (stride) + (offset) * elt_byte; \
+      ld_width##_t val; \
+      if (VI_DIRECT_HIT(addr, elt_byte)) { \
+        val = from_le(*(ld_width##_t*)(direct_host + (addr & ~PGMASK))); \
+        MMU.log_direct_loads(addr, 1, elt_byte); \
+      } else { \
+        val = MMU.load_##ld_width(addr); \
+        VI_DIRECT_REFILL(addr, LOAD); \
+      } \
       switch(P.VU.vsew){ \
         case e8: \
           P.VU.elt<uint8_t>(vd + fn * vlmul, vreg_inx, true) = val; \
@@ -1627,24 +1930,40 @@ for (reg_t i = 0; i < vlmax; ++i) { \
           break; \
       } \
     } \
+    const reg_t n = bulk ? VI_LDST_BULK_RUN(elt_byte) : 0; \
+    if (n > 0) { \
+      const reg_t addr = baseAddr + (i + 1) * elt_byte; \
+      ld_width##_t *dst = P.VU.elt_group<ld_width##_t>(vd, i + 1 + n, true) + i + 1; \
+      memcpy(dst, direct_host + (addr & ~PGMASK), n * elt_byte); \
+      MMU.log_direct_loads(addr, n, elt_byte); \
+      i += n; \
+    } \
   } \
   P.VU.vstart = 0;
 
 #define VI_LD(stride, offset, ld_width, elt_byte) \
   VI_CHECK_SXX; \
-  VI_LD_COMMON(stride, offset, ld_width, elt_byte)
+  VI_LD_COMMON(stride, offset, ld_width, elt_byte, false)
+
+#define VI_LD_UNIT(ld_width, elt_byte) \
+  VI_CHECK_SXX; \
+  VI_LD_COMMON(0, i * nf + fn, ld_width, elt_byte, true)
 
 #define VI_LD_INDEX(stride, offset, ld_width, elt_byte) \
   VI_CHECK_LDST_INDEX; \
-  VI_LD_COMMON(stride, offset, ld_width, elt_byte)
+  VI_LD_COMMON(stride, offset, ld_width, elt_byte, false)
 
 #define VI_ST(stride, offset, st_width, elt_byte) \
   VI_CHECK_SXX; \
-  VI_ST_COMMON(stride, offset, st_width, elt_byte) \
+  VI_ST_COMMON(stride, offset, st_width, elt_byte, false) \
+
+#define VI_ST_UNIT(st_width, elt_byte) \
+  VI_CHECK_SXX; \
+  VI_ST_COMMON(0, i * nf + fn, st_width, elt_byte, true) \
 
 #define VI_ST_INDEX(stride, offset, st_width, elt_byte) \
   VI_CHECK_LDST_INDEX; \
-  VI_ST_COMMON(stride, offset, st_width, elt_byte) \
+  VI_ST_COMMON(stride, offset, st_width, elt_byte, false) \
 
 #define VI_LDST_FF(itype, tsew) \
   require(p->VU.vsew >= e##tsew && p->VU.vsew <= e64); \
@@ -1659,21 +1978,30 @@ for (reg_t i = 0; i < vlmax; ++i) { \
   const reg_t vlmul = P.VU.vlmul; \
   require(rd_num + nf * P.VU.vlmul <= NVPR); \
   p->VU.vstart = 0; \
+  const bool bulk = VI_LDST_BULK(true, tsew / 8); \
+  VI_DIRECT_VARS \
   for (reg_t i = 0; i < vl; ++i) { \
     VI_STRIP(i); \
     VI_ELEMENT_SKIP(i); \
     \
     for (reg_t fn = 0; fn < nf; ++fn) { \
+      const reg_t addr = baseAddr + (i * nf + fn) * (tsew / 8); \
       itype##64_t val; \
-      try { \
-        val = MMU.load_##itype##tsew(baseAddr + (i * nf + fn) * (tsew / 8)); \
-      } catch (trap_t& t) { \
-        if (i == 0) \
-          throw t; /* Only take exception on zeroth element */ \
-        /* Reduce VL if an exception occurs on a later element */ \
-        early_stop = true; \
-        P.VU.vl = i; \
-        break; \
+      if (VI_DIRECT_HIT(addr, tsew / 8)) { \
+        val = from_le(*(itype##tsew##_t*)(direct_host + (addr & ~PGMASK))); \
+        MMU.log_direct_loads(addr, 1, tsew / 8); \
+      } else { \
+        try { \
+          val = MMU.load_##itype##tsew(addr); \
+        } catch (trap_t& t) { \
+          if (i == 0) \
+            throw t; /* Only take exception on zeroth element */ \
+          /* Reduce VL if an exception occurs on a later element */ \
+          early_stop = true; \
+          P.VU.vl = i; \
+          break; \
+        } \
+        VI_DIRECT_REFILL(addr, LOAD); \
       } \
       \
       switch (sew) { \
@@ -1695,6 +2023,15 @@ for (reg_t i = 0; i < vlmax; ++i) { \
     if (early_stop) { \
       break; \
     } \
+    /* elements on a page already translated cannot fault */ \
+    const reg_t n = bulk ? VI_LDST_BULK_RUN(tsew / 8) : 0; \
+    if (n > 0) { \
+      const reg_t addr = baseAddr + (i + 1) * (tsew / 8); \
+      itype##tsew##_t *dst = P.VU.elt_group<itype##tsew##_t>(rd_num, i + 1 + n, true) + i + 1; \
+      memcpy(dst, direct_host + (addr & ~PGMASK), n * (tsew / 8)); \
+      MMU.log_direct_loads(addr, n, tsew / 8); \
+      i += n; \
+    } \
   }
 
 
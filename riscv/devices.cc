@@ -1,52 +1,105 @@
 #include "devices.h"
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/mman.h>
+
+void bus_t::insert(const range_t& range)
+{
+  auto it = std::lower_bound(ranges.begin(), ranges.end(), range.base,
+    [](const range_t& r, reg_t base) { return r.base < base; });
+  if (it != ranges.end() && it->base == range.base)
+    *it = range;
+  else
+    it = ranges.insert(it, range);
+
+  // each range extends up to the base of the next one
+  for (size_t i = 0; i < ranges.size(); i++)
+    ranges[i].limit = i + 1 < ranges.size() ? ranges[i + 1].base - 1 : reg_t(-1);
+}
 
 void bus_t::add_device(reg_t addr, abstract_device_t* dev)
 {
-  // Searching devices via lower_bound/upper_bound
-  // implicitly relies on the underlying std::map 
-  // container to sort the keys and provide ordered
-  // iteration over this sort, which it does. (python's
-  // SortedDict is a good analogy)
-  devices[addr] = dev;
+  insert({addr, 0, dev, DEVICE, NULL, 0});
 }
 
-bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+void bus_t::add_device(reg_t addr, mem_t* mem)
+{
+  insert({addr, 0, mem, MEMORY, mem->contents(), mem->size()});
+}
+
+const bus_t::range_t* bus_t::search(reg_t addr, size_t* hint)
 {
   // Find the device with the base address closest to but
   // less than addr (price-is-right search)
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
-    // Either the bus is empty, or there weren't 
+  auto it = std::upper_bound(ranges.begin(), ranges.end(), addr,
+    [](reg_t addr, const range_t& r) { return addr < r.base; });
+  if (it == ranges.begin()) {
+    // Either the bus is empty, or there weren't
     // any items with a base address <= addr
-    return false;
+    return NULL;
   }
-  // Found at least one item with base address <= addr
-  // The iterator points to the device after this, so
-  // go back by one item.
-  it--;
-  return it->second->load(addr - it->first, len, bytes);
+  --it;
+  *hint = it - ranges.begin();
+  return &*it;
+}
+
+bool bus_t::load(reg_t addr, size_t len, uint8_t* bytes)
+{
+  auto r = find_range(addr, &last_hit);
+  if (!r)
+    return false;
+  return r->dev->load(addr - r->base, len, bytes);
 }
 
 bool bus_t::store(reg_t addr, size_t len, const uint8_t* bytes)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  auto r = find_range(addr, &last_hit);
+  if (!r)
     return false;
-  }
-  it--;
-  return it->second->store(addr - it->first, len, bytes);
+  return r->dev->store(addr - r->base, len, bytes);
 }
 
 std::pair<reg_t, abstract_device_t*> bus_t::find_device(reg_t addr)
 {
-  // See comments in bus_t::load
-  auto it = devices.upper_bound(addr);
-  if (devices.empty() || it == devices.begin()) {
+  size_t hint = last_hit;
+  auto r = find_range(addr, &hint);
+  if (!r)
     return std::make_pair((reg_t)0, (abstract_device_t*)NULL);
-  }
-  it--;
-  return std::make_pair(it->first, it->second);
+  return std::make_pair(r->base, r->dev);
+}
+
+static size_t mem_mapping_size(size_t size)
+{
+  size_t page = sysconf(_SC_PAGESIZE);
+  return (size + page - 1) / page * page;
+}
+
+mem_t::mem_t(size_t size) : len(size)
+{
+  if (!size)
+    throw std::runtime_error("zero bytes of target memory requested");
+  // Reserve address space only: pages are zero-filled on first touch, so
+  // untouched target memory costs neither RAM nor swap.
+  void* p = mmap(NULL, mem_mapping_size(size), PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (p == MAP_FAILED)
+    throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
+  data = (char*)p;
+}
+
+mem_t::~mem_t()
+{
+  munmap(data, mem_mapping_size(len));
+}
+
+bool mem_t::use_hugepages()
+{
+#ifdef MADV_HUGEPAGE
+  return madvise(data, mem_mapping_size(len), MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif
 }
 
 // Type for holding all registered MMIO plugins by name.
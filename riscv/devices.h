@@ -9,6 +9,7 @@
 #include <vector>
 
 class processor_t;
+class checkpoint_t;
 
 class abstract_device_t {
  public:
@@ -17,16 +18,48 @@ class abstract_device_t {
   virtual ~abstract_device_t() {}
 };
 
+class mem_t;
+
 class bus_t : public abstract_device_t {
  public:
+  // A device occupies the physical addresses from its base up to the next
+  // device's base. Memory (mem_t) ranges also record their host contents,
+  // so that they can be resolved without asking the device.
+  enum kind_t { DEVICE, MEMORY };
+  struct range_t {
+    reg_t base;
+    reg_t limit; // last address of the range
+    abstract_device_t* dev;
+    kind_t kind;
+    char* contents;
+    reg_t size;
+  };
+
+  bus_t() : last_hit(0) {}
   bool load(reg_t addr, size_t len, uint8_t* bytes);
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   void add_device(reg_t addr, abstract_device_t* dev);
+  void add_device(reg_t addr, mem_t* mem);
 
   std::pair<reg_t, abstract_device_t*> find_device(reg_t addr);
 
+  // Returns the range containing addr, or NULL. *hint remembers the index
+  // of the caller's previous hit, which is checked before searching.
+  inline const range_t* find_range(reg_t addr, size_t* hint)
+  {
+    if (likely(*hint < ranges.size())) {
+      const range_t& r = ranges[*hint];
+      if (addr - r.base <= r.limit - r.base)
+        return &r;
+    }
+    return search(addr, hint);
+  }
+
  private:
-  std::map<reg_t, abstract_device_t*> devices;
+  std::vector<range_t> ranges; // sorted by base
+  size_t last_hit; // hint for load/store, which callers serialise
+  const range_t* search(reg_t addr, size_t* hint);
+  void insert(const range_t& range);
 };
 
 class rom_device_t : public abstract_device_t {
@@ -41,20 +74,20 @@ class rom_device_t : public abstract_device_t {
 
 class mem_t : public abstract_device_t {
  public:
-  mem_t(size_t size) : len(size) {
-    if (!size)
-      throw std::runtime_error("zero bytes of target memory requested");
-    data = (char*)calloc(1, size);
-    if (!data)
-      throw std::runtime_error("couldn't allocate " + std::to_string(size) + " bytes of target memory");
-  }
+  // The contents are page-aligned and padded to a whole number of pages, so
+  // that a checkpoint image can be mapped over them.  Host memory is only
+  // committed as the target touches it.
+  mem_t(size_t size);
   mem_t(const mem_t& that) = delete;
-  ~mem_t() { free(data); }
+  ~mem_t();
 
   bool load(reg_t addr, size_t len, uint8_t* bytes) { return false; }
   bool store(reg_t addr, size_t len, const uint8_t* bytes) { return false; }
   char* contents() { return data; }
   size_t size() { return len; }
+  // back the contents with transparent huge pages where the host allows it;
+  // returns false if it does not
+  bool use_hugepages();
 
  private:
   char* data;
@@ -68,7 +101,9 @@ class clint_t : public abstract_device_t {
   bool store(reg_t addr, size_t len, const uint8_t* bytes);
   size_t size() { return CLINT_SIZE; }
   void increment(reg_t inc);
+  void checkpoint(checkpoint_t& cp);
  private:
+  void set_mip(processor_t* proc, reg_t bit, bool value);
   typedef uint64_t mtime_t;
   typedef uint64_t mtimecmp_t;
   typedef uint32_t msip_t;
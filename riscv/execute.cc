@@ -2,6 +2,7 @@
 
 #include "processor.h"
 #include "mmu.h"
+#include "commitlog.h"
 #include <cassert>
 
 
@@ -15,39 +16,6 @@ static void commit_log_stash_privilege(processor_t* p)
 #endif
 }
 
-static void commit_log_print_value(int width, const void *data)
-{
-  const uint64_t *arr = (const uint64_t *)data;
-
-  fprintf(stderr, "0x");
-  for (int idx = width / 64 - 1; idx >= 0; --idx) {
-    fprintf(stderr, "%016" PRIx64, arr[idx]);
-  }
-}
-
-static void commit_log_print_value(int width, uint64_t hi, uint64_t lo)
-{
-  switch (width) {
-    case 8:
-      fprintf(stderr, "0x%01" PRIx8, (uint8_t)lo);
-      break;
-    case 16:
-      fprintf(stderr, "0x%04" PRIx16, (uint16_t)lo);
-      break;
-    case 32:
-      fprintf(stderr, "0x%08" PRIx32, (uint32_t)lo);
-      break;
-    case 64:
-      fprintf(stderr, "0x%016" PRIx64, lo);
-      break;
-    case 128:
-      fprintf(stderr, "0x%016" PRIx64 "%016" PRIx64, hi, lo);
-      break;
-    default:
-      abort();
-  }
-}
-
 static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn)
 {
 #ifdef RISCV_ENABLE_COMMITLOG
@@ -59,9 +27,9 @@ static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn)
   int flen = p->get_state()->last_inst_flen;
 
   fprintf(stderr, "%1d ", priv);
-  commit_log_print_value(xlen, 0, pc);
+  commit_log_print_value(stderr, xlen, 0, pc);
   fprintf(stderr, " (");
-  commit_log_print_value(insn.length() * 8, 0, insn.bits());
+  commit_log_print_value(stderr, insn.length() * 8, 0, insn.bits());
   fprintf(stderr, ")");
 
   for (auto item : reg) {
@@ -96,21 +64,21 @@ static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn)
 
     fprintf(stderr, " %c%2d ", prefix, rd);
     if (is_vec)
-        commit_log_print_value(size, &p->VU.elt<uint8_t>(rd, 0));
+        commit_log_print_value(stderr, size, &p->VU.elt<uint8_t>(rd, 0));
     else
-        commit_log_print_value(size, item.second.v[1], item.second.v[0]);
+        commit_log_print_value(stderr, size, item.second.v[1], item.second.v[0]);
   }
 
   for (auto item : load) {
     fprintf(stderr, " mem ");
-    commit_log_print_value(xlen, 0, std::get<0>(item));
+    commit_log_print_value(stderr, xlen, 0, std::get<0>(item));
   }
 
   for (auto item : store) {
     fprintf(stderr, " mem ");
-    commit_log_print_value(xlen, 0, std::get<0>(item));
+    commit_log_print_value(stderr, xlen, 0, std::get<0>(item));
     fprintf(stderr, " ");
-    commit_log_print_value(std::get<2>(item) << 3, 0, std::get<1>(item));
+    commit_log_print_value(stderr, std::get<2>(item) << 3, 0, std::get<1>(item));
   }
   fprintf(stderr, "\n");
   reg.clear();
@@ -119,29 +87,135 @@ static void commit_log_print_insn(processor_t* p, reg_t pc, insn_t insn)
 #endif
 }
 
-inline void processor_t::update_histogram(reg_t pc)
+template<class T>
+static void commit_trace_put(std::vector<char>& buf, const T& value)
+{
+  buf.insert(buf.end(), (const char*)&value, (const char*)&value + sizeof(value));
+}
+
+// The binary counterpart of commit_log_print_insn; see commitlog.h.
+void processor_t::commit_trace_insn(reg_t pc, insn_t insn)
+{
+#ifdef RISCV_ENABLE_COMMITLOG
+  auto& reg = state.log_reg_write;
+  auto& load = state.log_mem_read;
+  auto& store = state.log_mem_write;
+  auto& buf = commit_trace_buf;
+
+  commit_trace_insn_t rec;
+  rec.pc = pc;
+  rec.bits = insn.bits();
+  rec.priv = state.last_inst_priv;
+  rec.xlen = state.last_inst_xlen;
+  rec.flen = state.last_inst_flen;
+  rec.nregs = 0;
+  for (auto item : reg)
+    rec.nregs += item.first != 0;
+  rec.nloads = load.size();
+  rec.nstores = store.size();
+  commit_trace_put(buf, rec);
+
+  for (auto item : reg) {
+    if (item.first == 0)
+      continue;
+
+    commit_trace_reg_t r = {(uint16_t)item.first, 0, 0, 0, 0};
+    switch (item.first & 3) {
+    case 0:
+      r.width = rec.xlen;
+      commit_trace_put(buf, r);
+      commit_trace_put(buf, item.second);
+      break;
+    case 1:
+      r.width = rec.flen;
+      commit_trace_put(buf, r);
+      commit_trace_put(buf, item.second);
+      break;
+    case 2: {
+      r.width = VU.VLEN;
+      r.vsew = VU.vsew >> 3;
+      r.vlmul = VU.vlmul;
+      commit_trace_put(buf, r);
+      const char* data = (const char*)&VU.elt<uint8_t>(item.first >> 2, 0);
+      buf.insert(buf.end(), data, data + VU.VLEN / 8);
+      break;
+    }
+    default:
+      assert("can't been here" && 0);
+      break;
+    }
+  }
+
+  for (auto item : load)
+    commit_trace_put(buf, (uint64_t)std::get<0>(item));
+
+  for (auto item : store) {
+    commit_trace_put(buf, (uint64_t)std::get<0>(item));
+    commit_trace_put(buf, (uint64_t)std::get<1>(item));
+    commit_trace_put(buf, (uint8_t)std::get<2>(item));
+  }
+
+  reg.clear();
+  load.clear();
+  store.clear();
+
+  if (buf.size() >= commit_trace_t::BUFFER_SIZE)
+    flush_commit_trace();
+#endif
+}
+
+void processor_t::flush_commit_trace()
+{
+  if (commit_trace && !commit_trace_buf.empty())
+    commit_trace->submit(commit_trace_buf);
+}
+
+// count is the counter cached in the instruction's decoded icache entry, if
+// it has one.
+inline void processor_t::update_histogram(reg_t pc, insn_t insn, uint64_t* count)
 {
 #ifdef RISCV_ENABLE_HISTOGRAM
-  pc_histogram[pc]++;
+  if (likely(count != NULL))
+    ++*count;
+  else if (histogram_enabled)
+    ++*profile.counter(pc, insn.bits());
 #endif
 }
 
 // This is expected to be inlined by the compiler so each use of execute_insn
 // includes a duplicated body of the function to get separate fetch.func
 // function calls.
-static reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch)
+static reg_t execute_insn(processor_t* p, reg_t pc, insn_fetch_t fetch, uint64_t* count = NULL)
 {
   commit_log_stash_privilege(p);
   reg_t npc = fetch.func(p, fetch.insn, pc);
-  if (npc != PC_SERIALIZE_BEFORE) {
+  if (npc != PC_SERIALIZE_BEFORE && npc != PC_TRAP) {
     if (p->get_log_commits()) {
-      commit_log_print_insn(p, pc, fetch.insn);
+      if (p->get_commit_trace())
+        p->commit_trace_insn(pc, fetch.insn);
+      else
+        commit_log_print_insn(p, pc, fetch.insn);
     }
-    p->update_histogram(pc);
+    p->update_histogram(pc, fetch.insn, count);
   }
   return npc;
 }
 
+// Takes a trap raised by the instruction at epc, from within step().
+void processor_t::take_trap_in_step(trap_t& t, reg_t epc)
+{
+  take_trap(t, epc);
+
+  if (rvfi_dii) {
+    rvfi_dii_output.rvfi_dii_trap = 1;
+  }
+
+  if (unlikely(state.single_step == state.STEP_STEPPED)) {
+    state.single_step = state.STEP_NONE;
+    enter_debug_mode(DCSR_CAUSE_STEP);
+  }
+}
+
 bool processor_t::slow_path()
 {
   return rvfi_dii || debug || state.single_step != state.STEP_NONE || state.debug_mode;
@@ -166,14 +240,17 @@ void processor_t::step(size_t n, insn_t insn)
 
     #define advance_pc() \
      if (unlikely(invalid_pc(pc))) { \
+       bool trapped = pc == PC_TRAP; \
        switch (pc) { \
          case PC_SERIALIZE_BEFORE: state.serialized = true; break; \
          case PC_SERIALIZE_AFTER: ++instret; break; \
          case PC_SERIALIZE_WFI: n = ++instret; break; \
+         case PC_TRAP: take_trap_in_step(pending_trap, state.pc); n = instret; break; \
          default: abort(); \
        } \
        pc = state.pc; \
-       if (rvfi_dii) { \
+       /* like thrown traps, deferred ones leave pc_wdata unset */ \
+       if (rvfi_dii && !trapped) { \
          rvfi_dii_output.rvfi_dii_pc_wdata = ext ? ext->to_arch_pc(pc) : pc; \
        } \
        break; \
@@ -253,6 +330,32 @@ void processor_t::step(size_t n, insn_t insn)
       }
       else while (instret < n)
       {
+        // When neither fetch triggers nor fetch tracing are active, run a
+        // whole pre-decoded straight-line block per lookup. Each instruction
+        // still has its fetch checked, and the block is left as soon as the
+        // pc does not fall through to the next decoded instruction.
+        if (likely(_mmu->block_cache_usable())) {
+          auto block = _mmu->access_block(pc);
+          if (unlikely(!block)) {
+            pc = PC_TRAP;
+            advance_pc();
+          }
+          for (size_t i = 0; ; ) {
+            insn_fetch_t fetch = block->insns[i];
+            _mmu->check_ifetch(pc, fetch.insn);
+            reg_t next_pc = pc + fetch.insn.length();
+            pc = execute_insn(this, pc, fetch, block->counts[i]);
+            if (++i == block->length) break;
+            if (unlikely(pc != next_pc)) break;
+            if (unlikely(instret+1 == n)) break;
+            instret++;
+            state.pc = pc;
+          }
+
+          advance_pc();
+          continue;
+        }
+
         // This code uses a modified Duff's Device to improve the performance
         // of executing instructions. While typical Duff's Devices are used
         // for software pipelining, the switch statement below primarily
@@ -273,19 +376,28 @@ void processor_t::step(size_t n, insn_t insn)
 
         // This gets the cached decoded instruction from the MMU. If the MMU
         // does not have the current pc cached, it will refill the MMU and
-        // return the correct entry. ic_entry->data.func is the C++ function
-        // corresponding to the instruction.
+        // return the correct entry, or NULL if the fetch faults.
+        // ic_entry->data.func is the C++ function corresponding to the
+        // instruction.
         auto ic_entry = _mmu->access_icache(pc);
+        if (unlikely(!ic_entry)) {
+          pc = PC_TRAP;
+          advance_pc();
+        }
 
         // This macro is included in "icache.h" included within the switch
         // statement below. The indirect jump corresponding to the instruction
-        // is located within the execute_insn() function call.
+        // is located within the execute_insn() function call. An instruction
+        // that switches translation context also switches icache banks, so
+        // the next entry must still be in the current one.
         #define ICACHE_ACCESS(i) { \
           insn_fetch_t fetch = ic_entry->data; \
-          pc = execute_insn(this, pc, fetch); \
+          _mmu->trace_insn_fetch(ic_entry); \
+          pc = execute_insn(this, pc, fetch, ic_entry->count); \
           ic_entry = ic_entry->next; \
           if (i == mmu_t::ICACHE_ENTRIES-1) break; \
           if (unlikely(ic_entry->tag != pc)) break; \
+          if (unlikely(ic_entry != &_mmu->icache[_mmu->icache_index(pc)])) break; \
           if (unlikely(instret+1 == n)) break; \
           instret++; \
           state.pc = pc; \
@@ -303,18 +415,8 @@ void processor_t::step(size_t n, insn_t insn)
     }
     catch(trap_t& t)
     {
-      take_trap(t, pc);
+      take_trap_in_step(t, pc);
       n = instret;
-
-
-      if (rvfi_dii) {
-        rvfi_dii_output.rvfi_dii_trap = 1;
-      }
-
-      if (unlikely(state.single_step == state.STEP_STEPPED)) {
-        state.single_step = state.STEP_NONE;
-        enter_debug_mode(DCSR_CAUSE_STEP);
-      }
     }
     catch (trigger_matched_t& t)
     {
@@ -344,18 +446,13 @@ void processor_t::step(size_t n, insn_t insn)
           abort();
       }
     }
-    catch (wait_for_interrupt_t &t)
-    {
-      // Return to the outer simulation loop, which gives other devices/harts a
-      // chance to generate interrupts.
-      //
-      // In the debug ROM this prevents us from wasting time looping, but also
-      // allows us to switch to other threads only once per idle loop in case
-      // there is activity.
-      n = instret;
-    }
 
     state.minstret += instret;
     n -= instret;
   }
+
+  // hand the trace over at the end of every quantum, so that records from
+  // different harts are written in the order they were executed
+  flush_commit_trace();
+  mmu->flush_trace_buffer();
 }
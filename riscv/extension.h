@@ -22,6 +22,11 @@ class extension_t
   virtual reg_t from_arch_pc(reg_t pc) { return pc; }
   virtual reg_t to_arch_pc(reg_t pc) { return pc; }
   virtual void check_ifetch_granule(reg_t start_pc, reg_t pc) {}
+  // Fetches from [*lo, *hi) pass check_ifetch_granule until the extension
+  // calls mmu_t::flush_fetch_bounds().
+  virtual void get_fetch_bounds(reg_t* lo, reg_t* hi) { *lo = 0; *hi = -1; }
+  // save or restore any architectural state the extension keeps itself
+  virtual void checkpoint(checkpoint_t& cp) {}
  protected:
   processor_t* p;
 
@@ -0,0 +1,231 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_HOSTFP_H
+#define _RISCV_HOSTFP_H
+
+// Host FPU versions of the common F and D operations, used instead of
+// softfloat when spike runs with --host-fp.  Each gives exactly the result
+// and flags of the softfloat routine it stands in for: the host only runs
+// the operation when the rounding mode is round-to-nearest-even (or, for
+// conversions to integer, round-towards-zero) and the operands are zero or
+// normal, and keeps the result only if the host raised nothing but the
+// inexact flag.  Everything else (NaNs, infinities, subnormals, overflow,
+// underflow, invalid operations) is redone by softfloat.
+
+#include "common.h"
+#include "softfloat.h"
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <cfenv>
+#if defined(__SSE2_MATH__)
+#include <xmmintrin.h>
+#endif
+
+#define HOST_FP(op, ...) (p->host_fp ? host_##op(__VA_ARGS__) : op(__VA_ARGS__))
+
+// With excess precision, host results would be rounded twice.
+#if FLT_EVAL_METHOD == 0
+#define HOST_FP_USABLE true
+#else
+#define HOST_FP_USABLE false
+#endif
+
+static inline void host_fp_clear_flags()
+{
+#if defined(__SSE2_MATH__)
+  // MXCSR is much cheaper to access than the whole floating-point environment
+  _mm_setcsr(_mm_getcsr() & ~0x3f);
+#else
+  feclearexcept(FE_ALL_EXCEPT);
+#endif
+}
+
+// softfloat flags for the host operation just done, or -1 if it raised
+// anything besides inexact
+static inline int host_fp_flags()
+{
+#if defined(__SSE2_MATH__)
+  unsigned flags = _mm_getcsr() & 0x3f;
+  const unsigned inexact = 0x20;
+#else
+  int flags = fetestexcept(FE_ALL_EXCEPT);
+  const int inexact = FE_INEXACT;
+#endif
+  if (flags & ~inexact)
+    return -1;
+  return flags ? softfloat_flag_inexact : 0;
+}
+
+static inline bool host_fp_ok(float32_t a)
+{
+  uint32_t exp = (a.v >> 23) & 0xff;
+  return exp != 0xff && (exp != 0 || (uint32_t)(a.v << 1) == 0);
+}
+
+static inline bool host_fp_ok(float64_t a)
+{
+  uint64_t exp = (a.v >> 52) & 0x7ff;
+  return exp != 0x7ff && (exp != 0 || (uint64_t)(a.v << 1) == 0);
+}
+
+static inline float host_value(float32_t a) { float f; memcpy(&f, &a.v, sizeof(f)); return f; }
+static inline double host_value(float64_t a) { double d; memcpy(&d, &a.v, sizeof(d)); return d; }
+static inline float32_t host_result(float f) { float32_t a; memcpy(&a.v, &f, sizeof(f)); return a; }
+static inline float64_t host_result(double d) { float64_t a; memcpy(&a.v, &d, sizeof(d)); return a; }
+
+static inline bool host_fp_rne()
+{
+  return HOST_FP_USABLE && softfloat_roundingMode == softfloat_round_near_even;
+}
+
+// Computes expr with the host flags cleared beforehand and returns it, if
+// the host raised at most the inexact flag.  The operands and result pass
+// through volatiles so the compiler cannot move the arithmetic across the
+// flag accesses.
+#define HOST_FP_RUN(htype, expr) \
+  do { \
+    host_fp_clear_flags(); \
+    volatile htype r = (expr); \
+    int flags = host_fp_flags(); \
+    if (likely(flags >= 0)) { \
+      softfloat_exceptionFlags |= flags; \
+      return host_result((htype)r); \
+    } \
+  } while (0)
+
+#define HOST_FP_BINARY(name, type, htype, op) \
+  static inline type host_##name(type a, type b) \
+  { \
+    if (host_fp_rne() && host_fp_ok(a) && host_fp_ok(b)) { \
+      volatile htype x = host_value(a), y = host_value(b); \
+      HOST_FP_RUN(htype, x op y); \
+    } \
+    return name(a, b); \
+  }
+
+HOST_FP_BINARY(f32_add, float32_t, float, +)
+HOST_FP_BINARY(f32_sub, float32_t, float, -)
+HOST_FP_BINARY(f32_mul, float32_t, float, *)
+HOST_FP_BINARY(f32_div, float32_t, float, /)
+HOST_FP_BINARY(f64_add, float64_t, double, +)
+HOST_FP_BINARY(f64_sub, float64_t, double, -)
+HOST_FP_BINARY(f64_mul, float64_t, double, *)
+HOST_FP_BINARY(f64_div, float64_t, double, /)
+
+#undef HOST_FP_BINARY
+
+// square roots of negative numbers are left to softfloat, so that the
+// call below needs no errno handling
+#define HOST_FP_SQRT(name, type, htype, sign, func) \
+  static inline type host_##name(type a) \
+  { \
+    if (host_fp_rne() && host_fp_ok(a) && !(a.v & (sign))) { \
+      volatile htype x = host_value(a); \
+      HOST_FP_RUN(htype, func(x)); \
+    } \
+    return name(a); \
+  }
+
+HOST_FP_SQRT(f32_sqrt, float32_t, float, UINT32_C(1) << 31, sqrtf)
+HOST_FP_SQRT(f64_sqrt, float64_t, double, UINT64_C(1) << 63, sqrt)
+
+#undef HOST_FP_SQRT
+
+// Fused multiply-add is only worth doing on the host when it is a single
+// instruction; library versions are no faster than softfloat.
+#define HOST_FP_MULADD(name, type, htype, func, fast) \
+  static inline type host_##name(type a, type b, type c) \
+  { \
+    if (fast && host_fp_rne() && host_fp_ok(a) && host_fp_ok(b) && host_fp_ok(c)) { \
+      volatile htype x = host_value(a), y = host_value(b), z = host_value(c); \
+      HOST_FP_RUN(htype, func(x, y, z)); \
+    } \
+    return name(a, b, c); \
+  }
+
+#ifdef FP_FAST_FMAF
+HOST_FP_MULADD(f32_mulAdd, float32_t, float, fmaf, true)
+#else
+HOST_FP_MULADD(f32_mulAdd, float32_t, float, fmaf, false)
+#endif
+#ifdef FP_FAST_FMA
+HOST_FP_MULADD(f64_mulAdd, float64_t, double, fma, true)
+#else
+HOST_FP_MULADD(f64_mulAdd, float64_t, double, fma, false)
+#endif
+
+#undef HOST_FP_MULADD
+
+static inline float64_t host_f32_to_f64(float32_t a)
+{
+  // widening a zero or normal number is always exact
+  if (HOST_FP_USABLE && host_fp_ok(a))
+    return host_result((double)host_value(a));
+  return f32_to_f64(a);
+}
+
+static inline float32_t host_f64_to_f32(float64_t a)
+{
+  if (host_fp_rne() && host_fp_ok(a)) {
+    volatile double x = host_value(a);
+    HOST_FP_RUN(float, (float)x);
+  }
+  return f64_to_f32(a);
+}
+
+// integer to floating point; types of up to 32 bits convert to double
+// exactly, and unsigned 64-bit values with the top bit set are left to
+// softfloat
+#define HOST_FP_FROM_INT(name, type, htype, itype, in_range) \
+  static inline type host_##name(itype i) \
+  { \
+    if (host_fp_rne() && (in_range)) { \
+      volatile itype x = i; \
+      HOST_FP_RUN(htype, (htype)x); \
+    } \
+    return name(i); \
+  }
+
+HOST_FP_FROM_INT(i32_to_f32, float32_t, float, int32_t, true)
+HOST_FP_FROM_INT(ui32_to_f32, float32_t, float, uint32_t, true)
+HOST_FP_FROM_INT(i64_to_f32, float32_t, float, int64_t, true)
+HOST_FP_FROM_INT(ui64_to_f32, float32_t, float, uint64_t, (int64_t)i >= 0)
+HOST_FP_FROM_INT(i32_to_f64, float64_t, double, int32_t, true)
+HOST_FP_FROM_INT(ui32_to_f64, float64_t, double, uint32_t, true)
+HOST_FP_FROM_INT(i64_to_f64, float64_t, double, int64_t, true)
+HOST_FP_FROM_INT(ui64_to_f64, float64_t, double, uint64_t, (int64_t)i >= 0)
+
+#undef HOST_FP_FROM_INT
+
+// Floating point to integer, rounding towards zero, for values whose
+// truncation fits in the result type; C's conversion truncates, and the
+// result is inexact iff converting it back does not give the operand.
+#define HOST_FP_TO_INT(name, type, htype, itype, lo, hi) \
+  static inline itype##_t host_##name(type a, uint_fast8_t rm, bool exact) \
+  { \
+    if (HOST_FP_USABLE && rm == softfloat_round_minMag && host_fp_ok(a)) { \
+      htype x = host_value(a); \
+      if (x > (htype)(lo) && x < (htype)(hi)) { \
+        itype##_t i = (itype##_t)x; \
+        if (exact && (htype)i != x) \
+          softfloat_exceptionFlags |= softfloat_flag_inexact; \
+        return i; \
+      } \
+    } \
+    return name(a, rm, exact); \
+  }
+
+HOST_FP_TO_INT(f32_to_i32, float32_t, float, int_fast32, -2147483649.0, 2147483648.0)
+HOST_FP_TO_INT(f32_to_ui32, float32_t, float, uint_fast32, -1.0, 4294967296.0)
+HOST_FP_TO_INT(f32_to_i64, float32_t, float, int_fast64, -9223372036854775808.0, 9223372036854775808.0)
+HOST_FP_TO_INT(f32_to_ui64, float32_t, float, uint_fast64, -1.0, 18446744073709551616.0)
+HOST_FP_TO_INT(f64_to_i32, float64_t, double, int_fast32, -2147483649.0, 2147483648.0)
+HOST_FP_TO_INT(f64_to_ui32, float64_t, double, uint_fast32, -1.0, 4294967296.0)
+HOST_FP_TO_INT(f64_to_i64, float64_t, double, int_fast64, -9223372036854775808.0, 9223372036854775808.0)
+HOST_FP_TO_INT(f64_to_ui64, float64_t, double, uint_fast64, -1.0, 18446744073709551616.0)
+
+#undef HOST_FP_TO_INT
+#undef HOST_FP_RUN
+
+#endif
@@ -5,9 +5,15 @@
 #include "softfloat.h"
 #include "internals.h"
 #include "specialize.h"
+#include "hostfp.h"
 #include "tracer.h"
 #include <assert.h>
 
 #ifdef ENABLE_CHERI
 #include "cheri.h"
 #endif
+
+// Within instruction bodies, illegal instruction exceptions are raised
+// without unwinding.
+#undef require
+#define require(x) if (unlikely(!(x))) return_trap(trap_illegal_instruction(0))
@@ -5,6 +5,7 @@ p->set_privilege(STATE.dcsr.prv);
 
 /* We're not in Debug Mode anymore. */
 STATE.debug_mode = false;
+p->get_mmu()->flush_tlb();
 
 if (STATE.dcsr.step)
   STATE.single_step = STATE.STEP_STEPPING;
@@ -1,5 +1,5 @@
 require_extension('D');
 require_fp;
 softfloat_roundingMode = RM;
-WRITE_FRD(ui32_to_f64((uint32_t)RS1));
+WRITE_FRD(HOST_FP(ui32_to_f64, (uint32_t)RS1));
 set_fp_exceptions;
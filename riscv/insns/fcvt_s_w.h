@@ -1,5 +1,5 @@
 require_extension('F');
 require_fp;
 softfloat_roundingMode = RM;
-WRITE_FRD(i32_to_f32((int32_t)RS1));
+WRITE_FRD(HOST_FP(i32_to_f32, (int32_t)RS1));
 set_fp_exceptions;
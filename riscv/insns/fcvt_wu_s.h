@@ -1,5 +1,5 @@
 require_extension('F');
 require_fp;
 softfloat_roundingMode = RM;
-WRITE_RD(sext32(f32_to_ui32(f32(FRS1), RM, true)));
+WRITE_RD(sext32(HOST_FP(f32_to_ui32, f32(FRS1), RM, true)));
 set_fp_exceptions;
@@ -1,5 +1,5 @@
 require_extension('D');
 require_fp;
 softfloat_roundingMode = RM;
-WRITE_FRD(f64_sqrt(f64(FRS1)));
+WRITE_FRD(HOST_FP(f64_sqrt, f64(FRS1)));
 set_fp_exceptions;
@@ -1,7 +1,5 @@
 require_extension('A');
 
-bool have_reservation = MMU.check_load_reservation(RS1);
-MMU.amo_uint32(RS1, [&](uint32_t lhs) { return have_reservation ? RS2 : lhs; });
-MMU.yield_load_reservation();
+bool have_reservation = MMU.store_conditional_uint32(RS1, RS2);
 
 WRITE_RD(!have_reservation);
@@ -1,3 +1,3 @@
 require_extension('S');
 require_privilege(get_field(STATE.mstatus, MSTATUS_TVM) ? PRV_M : PRV_S);
-MMU.flush_tlb();
+MMU.sfence_vma(insn.rs1() != 0, RS1, insn.rs2() != 0, RS2);
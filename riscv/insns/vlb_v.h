@@ -1,3 +1,3 @@
 // vlb.v and vlseg[2-8]b.v
 require(P.VU.vsew >= e8);
-VI_LD(0, i * nf + fn, int8, 1);
+VI_LD_UNIT(int8, 1);
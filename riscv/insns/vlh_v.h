@@ -1,3 +1,3 @@
 // vlh.v and vlseg[2-8]h.v
 require(P.VU.vsew >= e16);
-VI_LD(0, i * nf + fn, int16, 2);
+VI_LD_UNIT(int16, 2);
@@ -1,3 +1,3 @@
 // vlwu.v and vlseg[2-8]wu.v
 require(P.VU.vsew >= e32);
-VI_LD(0, i * nf + fn, uint32, 4);
+VI_LD_UNIT(uint32, 4);
@@ -1,5 +1,5 @@
 // vsaddu vd, vs2, zimm5
-VI_VI_ULOOP
+VI_VI_ULOOP_SAT
 ({
   bool sat = false;
   vd = vs2 + simm5;
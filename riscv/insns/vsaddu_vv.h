@@ -1,5 +1,5 @@
 // vsaddu vd, vs2, vs1
-VI_VV_ULOOP
+VI_VV_ULOOP_SAT
 ({
   bool sat = false;
   vd = vs2 + vs1;
@@ -1,5 +1,5 @@
 // vsaddu vd, vs2, rs1
-VI_VX_ULOOP
+VI_VX_ULOOP_SAT
 ({
   bool sat = false;
   vd = vs2 + rs1;
@@ -1,3 +1,3 @@
 // vsb.v and vsseg[2-8]b.v
 require(P.VU.vsew >= e8);
-VI_ST(0, i * nf + fn, uint8, 1);
+VI_ST_UNIT(uint8, 1);
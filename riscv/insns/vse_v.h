@@ -2,12 +2,12 @@
 reg_t sew = P.VU.vsew;
 
 if (sew == e8) {
-  VI_ST(0, (i * nf + fn), uint8, 1);
+  VI_ST_UNIT(uint8, 1);
 } else if (sew == e16) {
-  VI_ST(0, (i * nf + fn), uint16, 2);
+  VI_ST_UNIT(uint16, 2);
 } else if (sew == e32) {
-  VI_ST(0, (i * nf + fn), uint32, 4);
+  VI_ST_UNIT(uint32, 4);
 } else if (sew == e64) {
-  VI_ST(0, (i * nf + fn), uint64, 8);
+  VI_ST_UNIT(uint64, 8);
 }
 
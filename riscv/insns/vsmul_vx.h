@@ -4,7 +4,7 @@ int64_t int_max = (uint64_t(1) << (P.VU.vsew - 1)) - 1;
 int64_t int_min = - (1 << (P.VU.vsew - 1));
 int64_t sign_mask = uint64_t(1) << (P.VU.vsew - 1);
 
-VI_VX_LOOP
+VI_VX_LOOP_SAT
 ({
   int64_t rs1_sign;
   int64_t vs2_sign;
@@ -1,3 +1,3 @@
 // vsw.v and vsseg[2-8]w.v
 require(P.VU.vsew >= e32);
-VI_ST(0, i * nf + fn, uint32, 4);
+VI_ST_UNIT(uint32, 4);
@@ -0,0 +1,169 @@
+// See LICENSE for license details.
+
+#include "memtracefile.h"
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static const size_t BUFFER_SIZE = 1 << 20;
+
+class memtrace_writer_t::hart_tracer_t : public memtracer_t
+{
+ public:
+  hart_tracer_t(memtrace_writer_t* writer, unsigned hart) : writer(writer), hart(hart) {}
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type) { return true; }
+  void trace(uint64_t addr, size_t bytes, access_type type) { writer->write(hart, addr, bytes, type); }
+  void reset() {}
+  void printstats() {}
+  void read_counter(uint64_t *ret_value, int idx) {}
+
+ private:
+  memtrace_writer_t* writer;
+  unsigned hart;
+};
+
+memtrace_writer_t::memtrace_writer_t(const char* path)
+  : last_hart(0)
+{
+  file = fopen(path, "wb");
+  if (!file)
+    throw std::runtime_error(std::string("couldn't open memory trace ") + path + ": " + strerror(errno));
+  fwrite(MEM_TRACE_MAGIC, 1, strlen(MEM_TRACE_MAGIC), file);
+  buf.reserve(BUFFER_SIZE + 64);
+}
+
+memtrace_writer_t::~memtrace_writer_t()
+{
+  flush();
+  fclose(file);
+}
+
+memtracer_t* memtrace_writer_t::get_tracer(unsigned hart)
+{
+  if (tracers.size() <= hart) {
+    tracers.resize(hart + 1);
+    last_addr.resize(3 * (hart + 1));
+  }
+  if (!tracers[hart])
+    tracers[hart].reset(new hart_tracer_t(this, hart));
+  return tracers[hart].get();
+}
+
+void memtrace_writer_t::put_varint(uint64_t x)
+{
+  while (x >= 0x80) {
+    buf.push_back(x | 0x80);
+    x >>= 7;
+  }
+  buf.push_back(x);
+}
+
+void memtrace_writer_t::write(unsigned hart, uint64_t addr, size_t bytes, access_type type)
+{
+  uint8_t header = type | (bytes < 32 ? bytes << 3 : 0);
+  if (hart != last_hart)
+    header |= 4;
+  buf.push_back(header);
+  if (hart != last_hart)
+    put_varint(hart);
+  if (bytes >= 32)
+    put_varint(bytes);
+
+  uint64_t& last = last_addr[3 * hart + type];
+  int64_t delta = addr - last;
+  put_varint((uint64_t(delta) << 1) ^ uint64_t(delta >> 63));
+  last = addr;
+  last_hart = hart;
+
+  if (buf.size() >= BUFFER_SIZE)
+    flush();
+}
+
+void memtrace_writer_t::flush()
+{
+  if (fwrite(buf.data(), 1, buf.size(), file) != buf.size()) {
+    fprintf(stderr, "error writing memory trace: %s\n", strerror(errno));
+    abort();
+  }
+  buf.clear();
+}
+
+memtrace_reader_t::memtrace_reader_t(const char* path)
+  : pos(0), hart(0)
+{
+  file = fopen(path, "rb");
+  if (!file)
+    throw std::runtime_error(std::string("couldn't open memory trace ") + path + ": " + strerror(errno));
+
+  char magic[sizeof(MEM_TRACE_MAGIC) - 1];
+  if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) ||
+      memcmp(magic, MEM_TRACE_MAGIC, sizeof(magic)) != 0) {
+    fclose(file);
+    throw std::runtime_error(std::string(path) + " is not a memory trace");
+  }
+  last_addr.resize(3);
+}
+
+memtrace_reader_t::~memtrace_reader_t()
+{
+  fclose(file);
+}
+
+// returns -1 at the end of the file
+int memtrace_reader_t::get()
+{
+  if (pos == buf.size()) {
+    buf.resize(BUFFER_SIZE);
+    buf.resize(fread(buf.data(), 1, BUFFER_SIZE, file));
+    pos = 0;
+    if (buf.empty())
+      return -1;
+  }
+  return buf[pos++];
+}
+
+uint64_t memtrace_reader_t::get_varint()
+{
+  uint64_t x = 0;
+  for (int shift = 0; ; shift += 7) {
+    // a 64-bit value takes at most 10 bytes
+    if (shift >= 64)
+      throw std::runtime_error("corrupt memory trace");
+    int c = get();
+    if (c < 0)
+      throw std::runtime_error("truncated memory trace");
+    x |= uint64_t(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return x;
+  }
+}
+
+bool memtrace_reader_t::next(memtrace_record_t& rec, unsigned& rec_hart)
+{
+  int header = get();
+  if (header < 0)
+    return false;
+
+  if (header & 4) {
+    uint64_t h = get_varint();
+    if (h >= MAX_HARTS)
+      throw std::runtime_error("corrupt memory trace");
+    hart = h;
+    if (last_addr.size() < 3 * (hart + 1))
+      last_addr.resize(3 * (hart + 1));
+  }
+  if ((header & 3) > FETCH)
+    throw std::runtime_error("corrupt memory trace");
+  rec.type = access_type(header & 3);
+  rec.bytes = header >> 3;
+  if (rec.bytes == 0)
+    rec.bytes = get_varint();
+
+  uint64_t zigzag = get_varint();
+  uint64_t& last = last_addr[3 * hart + rec.type];
+  last += (zigzag >> 1) ^ -(zigzag & 1);
+  rec.addr = last;
+  rec_hart = hart;
+  return true;
+}
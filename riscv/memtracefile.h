@@ -0,0 +1,73 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_MEMTRACEFILE_H
+#define _RISCV_MEMTRACEFILE_H
+
+#include "memtracer.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+// Binary physical-address trace of fetches, loads and stores.  After the
+// magic, each access is stored as
+//   a header byte: bits 0-1 the access_type, bit 2 set if a hart number
+//                  follows, and bits 3-7 the size in bytes, or 0 if the
+//                  size follows
+//   the hart number, if it differs from that of the previous access
+//   the size, if it is 32 bytes or more
+//   the address, as the difference from the previous address of the same
+//   type on the same hart
+// Numbers are LEB128 varints; the address difference is zigzag-encoded
+// first, so that small steps backwards are short too.
+
+#define MEM_TRACE_MAGIC "SPIKEMT1"
+
+class memtrace_writer_t
+{
+ public:
+  memtrace_writer_t(const char* path);
+  ~memtrace_writer_t();
+
+  // the tracer to register with hart's MMU
+  memtracer_t* get_tracer(unsigned hart);
+
+  void write(unsigned hart, uint64_t addr, size_t bytes, access_type type);
+
+ private:
+  class hart_tracer_t;
+
+  void flush();
+  void put_varint(uint64_t x);
+
+  FILE* file;
+  std::vector<uint8_t> buf;
+  unsigned last_hart;
+  std::vector<std::unique_ptr<hart_tracer_t>> tracers;
+  std::vector<uint64_t> last_addr; // per hart and access type
+};
+
+class memtrace_reader_t
+{
+ public:
+  memtrace_reader_t(const char* path);
+  ~memtrace_reader_t();
+
+  // Reads the next access, returning false at the end of the trace.
+  bool next(memtrace_record_t& rec, unsigned& hart);
+
+ private:
+  int get();
+  uint64_t get_varint();
+
+  // larger hart numbers can only come from a corrupt trace
+  static const unsigned MAX_HARTS = 1 << 16;
+
+  FILE* file;
+  std::vector<uint8_t> buf;
+  size_t pos;
+  unsigned hart;
+  std::vector<uint64_t> last_addr;
+};
+
+#endif
@@ -14,6 +14,13 @@ enum access_type {
   FETCH,
 };
 
+// an access buffered by the MMU until it is handed to the tracers
+struct memtrace_record_t {
+  uint64_t addr;
+  uint32_t bytes;
+  access_type type;
+};
+
 class memtracer_t
 {
  public:
@@ -22,6 +29,11 @@ class memtracer_t
 
   virtual bool interested_in_range(uint64_t begin, uint64_t end, access_type type) = 0;
   virtual void trace(uint64_t addr, size_t bytes, access_type type) = 0;
+  virtual void trace_batch(const memtrace_record_t* records, size_t n)
+  {
+    for (size_t i = 0; i < n; i++)
+      trace(records[i].addr, records[i].bytes, records[i].type);
+  }
   virtual void reset(void) = 0;
   virtual void printstats(void) = 0;
   virtual void read_counter(uint64_t *ret_value, int idx) = 0;
@@ -43,6 +55,17 @@ class memtracer_list_t : public memtracer_t
     for (std::vector<memtracer_t*>::iterator it = list.begin(); it != list.end(); ++it)
       (*it)->trace(addr, bytes, type);
   }
+  // Tracers may share a miss handler (the L2), so each record is passed to
+  // all of them before the next one.
+  void trace_batch(const memtrace_record_t* records, size_t n)
+  {
+    if (list.size() == 1) {
+      list[0]->trace_batch(records, n);
+      return;
+    }
+    for (size_t i = 0; i < n; i++)
+      trace(records[i].addr, records[i].bytes, records[i].type);
+  }
   void reset(void)
   {
     for (std::vector<memtracer_t*>::iterator it = list.begin(); it != list.end(); ++it)
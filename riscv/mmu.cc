@@ -4,6 +4,7 @@
 #include "mmu.h"
 #include "simif.h"
 #include "processor.h"
+#include <algorithm>
 
 mmu_t::mmu_t(simif_t* sim, processor_t* proc)
  : sim(sim), proc(proc),
@@ -12,6 +13,15 @@ mmu_t::mmu_t(simif_t* sim, processor_t* proc)
   check_triggers_store(false),
   matched_trigger(NULL)
 {
+  trace_fetch = false;
+  trace_buffer_used = 0;
+  host_atomics = false;
+  load_reservation_value = 0;
+  set_stlb_geometry(STLB_SETS, STLB_WAYS);
+  memset(pwc, 0, sizeof(pwc));
+  flush_pmp_cache();
+  icache_victim = 0;
+  set_translation_context(PRV_M, 0);
   flush_tlb();
   yield_load_reservation();
 }
@@ -20,35 +30,328 @@ mmu_t::~mmu_t()
 {
 }
 
-void mmu_t::flush_icache()
+void mmu_t::flush_icache_bank(icache_bank_t* bank)
 {
   for (size_t i = 0; i < ICACHE_ENTRIES; i++)
-    icache[i].tag = -1;
+    bank->icache[i].tag = -1;
+  for (size_t i = 0; i < BLOCK_CACHE_ENTRIES; i++)
+    bank->block_cache[i].tag = -1;
 }
 
-void mmu_t::flush_tlb()
+void mmu_t::flush_icache()
+{
+  for (auto& bank : icache_banks)
+    flush_icache_bank(bank.get());
+  flush_fetch_bounds();
+}
+
+void mmu_t::set_translation_context(reg_t prv, reg_t satp)
+{
+  flush_tlb_tags();
+  flush_fetch_bounds();
+
+  // contexts without translation share one bank per privilege
+  reg_t asid = 0;
+  if (decode_vm_info(proc ? proc->max_xlen : 64, prv, satp).levels == 0)
+    satp = 0;
+  else
+    asid = proc->max_xlen == 32 ? get_field(satp, SATP32_ASID)
+                                : get_field(satp, SATP64_ASID);
+
+  icache_bank_t* bank = NULL;
+  for (auto& b : icache_banks)
+    if (b->prv == prv && b->satp == satp)
+      bank = b.get();
+
+  if (!bank) {
+    if (icache_banks.size() < ICACHE_BANKS) {
+      icache_banks.emplace_back(new icache_bank_t);
+      bank = icache_banks.back().get();
+    } else {
+      bank = icache_banks[icache_victim].get();
+      icache_victim = (icache_victim + 1) % ICACHE_BANKS;
+    }
+    bank->prv = prv;
+    bank->satp = satp;
+    bank->asid = asid;
+    flush_icache_bank(bank);
+  }
+
+  icache = bank->icache;
+  block_cache = bank->block_cache;
+}
+
+void mmu_t::check_ifetch_slow(reg_t addr, insn_t insn)
+{
+  if (auto *ext = proc->get_extension()) {
+    ext->check_ifetch_granule(addr, addr);
+    for (int i = 2; i < insn.length(); i += 2)
+      ext->check_ifetch_granule(addr, addr + i);
+    ext->get_fetch_bounds(&fetch_lo, &fetch_hi);
+  } else {
+    fetch_lo = 0;
+    fetch_hi = -1;
+  }
+}
+
+// Instructions after which the following instruction may not be fetched
+// from the same straight-line block: control transfers, fences and system
+// instructions (which may change translation, privilege or flush caches).
+static bool ends_block(insn_t insn)
+{
+  insn_bits_t bits = insn.bits();
+  switch (insn.length()) {
+    case 2:
+      switch (bits & 0xe003) {
+        case 0xa001: // c.j
+        case 0xc001: // c.beqz
+        case 0xe001: // c.bnez
+          return true;
+        case 0x8002: // c.jr, c.jalr, c.ebreak
+          return insn.rs2() == 0;
+        default:
+          return false;
+      }
+    case 4:
+#ifdef ENABLE_CHERI
+      if ((bits & MASK_CJALR) == MATCH_CJALR ||
+          (bits & MASK_CCALL) == MATCH_CCALL ||
+          (bits & MASK_CSPECIALRW) == MATCH_CSPECIALRW)
+        return true;
+#endif
+      switch (bits & 0x7f) {
+        case 0x0f: // fence, fence.i
+        case 0x63: // branches
+        case 0x67: // jalr
+        case 0x6f: // jal
+        case 0x73: // system
+          return true;
+        default:
+          return false;
+      }
+    default:
+      return true;
+  }
+}
+
+block_cache_entry_t* mmu_t::refill_block(reg_t addr, block_cache_entry_t* block)
+{
+  // The first instruction is fetched architecturally and may trap.
+  icache_entry_t* entry = access_icache(addr);
+  if (!entry)
+    return NULL;
+  insn_fetch_t fetch = entry->data;
+  block->tag = -1;
+  block->insns[0] = fetch;
+  block->counts[0] = entry->count;
+  block->length = 1;
+
+  // The rest are fetched speculatively: stop at the first one that would
+  // leave this page or fail to translate, rather than raising its trap.
+  reg_t pc = addr;
+  while (block->length < block_cache_entry_t::MAX_INSNS && !ends_block(fetch.insn)) {
+    pc += fetch.insn.length();
+    if (((pc + MAX_INSN_LENGTH - 1) & PGMASK) != (addr & PGMASK))
+      break;
+
+    entry = &icache[icache_index(pc)];
+    if (entry->tag != pc) {
+      try {
+        refill_icache(pc, entry, false);
+      } catch (trap_t&) {
+        break;
+      }
+    }
+    fetch = entry->data;
+    block->insns[block->length] = fetch;
+    block->counts[block->length++] = entry->count;
+  }
+
+  block->tag = addr;
+  return block;
+}
+
+void mmu_t::flush_tlb_tags()
 {
   memset(tlb_insn_tag, -1, sizeof(tlb_insn_tag));
   memset(tlb_load_tag, -1, sizeof(tlb_load_tag));
   memset(tlb_store_tag, -1, sizeof(tlb_store_tag));
+}
+
+void mmu_t::flush_tlb()
+{
+  flush_tlb_tags();
+  leaf_shift = 0;
 
   flush_icache();
 }
 
-static void throw_access_exception(reg_t addr, access_type type)
+void mmu_t::flush_stlb(bool has_vaddr, reg_t vaddr, bool has_asid, reg_t asid)
+{
+  reg_t vpn = vaddr >> PGSHIFT;
+  if (proc)
+    asid &= get_field(reg_t(-1), proc->max_xlen == 32 ? SATP32_ASID : SATP64_ASID);
+  for (auto& e : stlb) {
+    if ((!has_vaddr || e.vpn == vpn >> e.vpn_shift) &&
+        (!has_asid || (!e.global && e.asid == asid)))
+      e.valid = false;
+  }
+  if (!has_vaddr && !has_asid)
+    stlb_shifts = 0;
+
+  int idxbits = proc && proc->max_xlen == 32 ? 10 : 9;
+  for (size_t level = 1; level <= PWC_LEVELS; level++) {
+    for (auto& e : pwc[level - 1]) {
+      if ((!has_vaddr || e.tag == vpn >> (level * idxbits)) &&
+          (!has_asid || (!e.global && e.asid == asid)))
+        e.valid = false;
+    }
+  }
+}
+
+void mmu_t::sfence_vma(bool has_vaddr, reg_t vaddr, bool has_asid, reg_t asid)
+{
+  flush_stlb(has_vaddr, vaddr, has_asid, asid);
+  if (proc)
+    asid &= get_field(reg_t(-1), proc->max_xlen == 32 ? SATP32_ASID : SATP64_ASID);
+
+  // The TLB and the icache are tagged by virtual address alone, so the
+  // entries a mapping of vaddr may have produced are those in the largest
+  // page translated since they were last flushed.
+  if (!has_vaddr)
+    flush_tlb_tags();
+  else {
+    reg_t vpn = vaddr >> PGSHIFT;
+    for (size_t i = 0; i < TLB_ENTRIES; i++) {
+      if (((tlb_insn_tag[i] & ~TLB_CHECK_TRIGGERS) ^ vpn) >> leaf_shift == 0)
+        tlb_insn_tag[i] = -1;
+      if (((tlb_load_tag[i] & ~(TLB_CHECK_TRIGGERS | TLB_TRACE)) ^ vpn) >> leaf_shift == 0)
+        tlb_load_tag[i] = -1;
+      if (((tlb_store_tag[i] & ~(TLB_CHECK_TRIGGERS | TLB_TRACE)) ^ vpn) >> leaf_shift == 0)
+        tlb_store_tag[i] = -1;
+    }
+  }
+
+  for (auto& bank : icache_banks) {
+    if (!bank->satp || (has_asid && bank->asid != asid))
+      continue;
+    if (!has_vaddr) {
+      flush_icache_bank(bank.get());
+      continue;
+    }
+    // an instruction starting at tag may run into the next page
+    reg_t shift = PGSHIFT + leaf_shift;
+    auto maps = [=](reg_t tag) {
+      return ((tag ^ vaddr) >> shift) == 0 ||
+             (((tag + MAX_INSN_LENGTH - 1) ^ vaddr) >> shift) == 0;
+    };
+    for (size_t i = 0; i < ICACHE_ENTRIES; i++)
+      if (maps(bank->icache[i].tag))
+        bank->icache[i].tag = -1;
+    for (size_t i = 0; i < BLOCK_CACHE_ENTRIES; i++)
+      if (maps(bank->block_cache[i].tag))
+        bank->block_cache[i].tag = -1;
+  }
+}
+
+void mmu_t::set_stlb_geometry(size_t sets, size_t ways)
+{
+  stlb_sets = sets;
+  stlb_ways = ways;
+  stlb.assign(sets * ways, stlb_entry_t());
+  stlb_victim.assign(sets, 0);
+  stlb_shifts = 0;
+}
+
+void mmu_t::flush_pmp_cache()
+{
+  for (auto& e : pmp_cache)
+    e.ppn = -1;
+}
+
+reg_t mmu_t::stlb_asid()
+{
+  return proc->max_xlen == 32 ? get_field(proc->state.satp, SATP32_ASID)
+                              : get_field(proc->state.satp, SATP64_ASID);
+}
+
+// Probe each mapping size currently cached, smallest first.
+stlb_entry_t* mmu_t::stlb_lookup(reg_t vpn, reg_t asid)
+{
+  for (reg_t shifts = stlb_shifts; shifts; shifts &= shifts - 1) {
+    unsigned shift = __builtin_ctzll(shifts);
+    reg_t tag = vpn >> shift;
+    stlb_entry_t* set = &stlb[(tag % stlb_sets) * stlb_ways];
+    for (size_t i = 0; i < stlb_ways; i++) {
+      if (set[i].valid && set[i].vpn_shift == shift && set[i].vpn == tag &&
+          (set[i].global || set[i].asid == asid))
+        return &set[i];
+    }
+  }
+  return NULL;
+}
+
+void mmu_t::stlb_insert(reg_t vpn, unsigned vpn_shift, reg_t asid, bool global,
+                        reg_t pte, reg_t paddr)
+{
+  reg_t tag = vpn >> vpn_shift;
+  size_t idx = tag % stlb_sets;
+  stlb_entry_t* set = &stlb[idx * stlb_ways];
+  stlb_entry_t* e = NULL;
+  for (size_t i = 0; i < stlb_ways && !e; i++) {
+    if (set[i].valid && set[i].vpn_shift == vpn_shift && set[i].vpn == tag &&
+        set[i].global == global && set[i].asid == asid)
+      e = &set[i];
+  }
+  if (!e) {
+    e = &set[stlb_victim[idx]];
+    stlb_victim[idx] = (stlb_victim[idx] + 1) % stlb_ways;
+  }
+
+  bool homogeneous = vpn_shift && pmp_homogeneous(paddr, PGSIZE << vpn_shift);
+  *e = {true, global, homogeneous, vpn_shift, asid, tag, pte, paddr};
+  stlb_shifts |= reg_t(1) << vpn_shift;
+}
+
+static reg_t access_fault_cause(access_type type)
 {
   switch (type) {
-    case FETCH: throw trap_instruction_access_fault(addr);
-    case LOAD: throw trap_load_access_fault(addr);
-    case STORE: throw trap_store_access_fault(addr);
+    case FETCH: return CAUSE_FETCH_ACCESS;
+    case LOAD: return CAUSE_LOAD_ACCESS;
+    case STORE: return CAUSE_STORE_ACCESS;
     default: abort();
   }
 }
 
-reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type)
+static reg_t page_fault_cause(access_type type)
 {
-  if (!proc)
-    return addr;
+  switch (type) {
+    case FETCH: return CAUSE_FETCH_PAGE_FAULT;
+    case LOAD: return CAUSE_LOAD_PAGE_FAULT;
+    case STORE: return CAUSE_STORE_PAGE_FAULT;
+    default: abort();
+  }
+}
+
+static void throw_translation_fault(reg_t cause, reg_t addr)
+{
+  switch (cause) {
+    case CAUSE_FETCH_ACCESS: throw trap_instruction_access_fault(addr);
+    case CAUSE_LOAD_ACCESS: throw trap_load_access_fault(addr);
+    case CAUSE_STORE_ACCESS: throw trap_store_access_fault(addr);
+    case CAUSE_FETCH_PAGE_FAULT: throw trap_instruction_page_fault(addr);
+    case CAUSE_LOAD_PAGE_FAULT: throw trap_load_page_fault(addr);
+    case CAUSE_STORE_PAGE_FAULT: throw trap_store_page_fault(addr);
+    default: abort();
+  }
+}
+
+bool mmu_t::try_translate(reg_t addr, reg_t len, access_type type, reg_t* paddr, reg_t* cause)
+{
+  if (!proc) {
+    *paddr = addr;
+    return true;
+  }
 
   reg_t mode = proc->state.prv;
   if (type != FETCH) {
@@ -56,12 +359,44 @@ reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type)
       mode = get_field(proc->state.mstatus, MSTATUS_MPP);
   }
 
-  reg_t paddr = walk(addr, type, mode) | (addr & (PGSIZE-1));
-  if (!pmp_ok(paddr, len, type, mode))
-    throw_access_exception(addr, type);
+  if (!walk(addr, type, mode, paddr, cause))
+    return false;
+  *paddr |= addr & (PGSIZE-1);
+  if (!pmp_ok(*paddr, len, type, mode)) {
+    *cause = access_fault_cause(type);
+    return false;
+  }
+  return true;
+}
+
+reg_t mmu_t::translate(reg_t addr, reg_t len, access_type type)
+{
+  reg_t paddr, cause;
+  if (!try_translate(addr, len, type, &paddr, &cause))
+    throw_translation_fault(cause, addr);
   return paddr;
 }
 
+bool mmu_t::probe_fetch_slow(reg_t addr)
+{
+  reg_t paddr, cause;
+  if (try_translate(addr, sizeof(fetch_temp), FETCH, &paddr, &cause)) {
+    // keep the translation, so refill_icache() does not walk again
+    if (auto host_addr = sim->addr_to_mem(paddr))
+      refill_tlb(addr, paddr, host_addr, FETCH);
+    return true;
+  }
+
+  // the extension's fetch checks take priority, as in refill_icache()
+  if (auto *ext = proc->get_extension())
+    ext->check_ifetch_granule(addr, addr);
+  if (cause == CAUSE_FETCH_PAGE_FAULT)
+    proc->defer_trap(trap_instruction_page_fault(addr));
+  else
+    proc->defer_trap(trap_instruction_access_fault(addr));
+  return false;
+}
+
 tlb_entry_t mmu_t::fetch_slow_path(reg_t vaddr)
 {
   reg_t paddr = translate(vaddr, sizeof(fetch_temp), FETCH);
@@ -99,7 +434,14 @@ reg_t reg_from_bytes(size_t len, const uint8_t* bytes)
         (((reg_t) bytes[6]) << 48) |
         (((reg_t) bytes[7]) << 56);
   }
-  abort();
+
+  // the parts of a misaligned access split at a page boundary
+  if (len > 8)
+    abort();
+  reg_t res = 0;
+  for (size_t i = 0; i < len; i++)
+    res |= ((reg_t) bytes[i]) << (i * 8);
+  return res;
 }
 
 void mmu_t::load_slow_path(reg_t addr, reg_t len, reg_t trace_mask_bytes,
@@ -112,9 +454,8 @@ void mmu_t::load_slow_path(reg_t addr, reg_t len, reg_t trace_mask_bytes,
   if (auto host_addr = sim->addr_to_mem(paddr)) {
     memcpy(bytes, host_addr, len);
     if (tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD))
-      tracer.trace(paddr, len, LOAD);
-    else
-      refill_tlb(addr, paddr, host_addr, LOAD);
+      trace_access(paddr, len, LOAD);
+    refill_tlb(addr, paddr, host_addr, LOAD);
   } else if (!sim->mmio_load(paddr, len, bytes)) {
     throw trap_load_access_fault(addr);
   }
@@ -144,22 +485,41 @@ void mmu_t::store_slow_path(reg_t addr, reg_t len, reg_t trace_mask_bytes,
   if (auto host_addr = sim->addr_to_mem(paddr)) {
     memcpy(host_addr, bytes, len);
     if (tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
-      tracer.trace(paddr, len, STORE);
-    else
-      refill_tlb(addr, paddr, host_addr, STORE);
+      trace_access(paddr, len, STORE);
+    refill_tlb(addr, paddr, host_addr, STORE);
   } else if (!sim->mmio_store(paddr, len, bytes)) {
     throw trap_store_access_fault(addr);
   }
 }
 
+// Returns the host address an AMO can operate on with host atomics, or NULL
+// if it must take the ordinary load/store path (MMIO, tracing, triggers).
+char* mmu_t::amo_host_addr(reg_t addr, reg_t len)
+{
+  if (check_triggers_load || check_triggers_store || (proc && proc->rvfi_dii))
+    return NULL;
+  reg_t vpn = addr >> PGSHIFT;
+  if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn))
+    return tlb_data[vpn % TLB_ENTRIES].host_offset + addr;
+
+  reg_t paddr = translate(addr, len, STORE);
+  auto host_addr = sim->addr_to_mem(paddr);
+  if (!host_addr ||
+      tracer.interested_in_range(paddr, paddr + PGSIZE, LOAD) ||
+      tracer.interested_in_range(paddr, paddr + PGSIZE, STORE))
+    return NULL;
+  refill_tlb(addr, paddr, host_addr, STORE);
+  return host_addr;
+}
+
 tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type)
 {
   reg_t idx = (vaddr >> PGSHIFT) % TLB_ENTRIES;
   reg_t expected_tag = vaddr >> PGSHIFT;
 
-  if ((tlb_load_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
+  if ((tlb_load_tag[idx] & ~(TLB_CHECK_TRIGGERS | TLB_TRACE)) != expected_tag)
     tlb_load_tag[idx] = -1;
-  if ((tlb_store_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
+  if ((tlb_store_tag[idx] & ~(TLB_CHECK_TRIGGERS | TLB_TRACE)) != expected_tag)
     tlb_store_tag[idx] = -1;
   if ((tlb_insn_tag[idx] & ~TLB_CHECK_TRIGGERS) != expected_tag)
     tlb_insn_tag[idx] = -1;
@@ -169,7 +529,19 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
       (check_triggers_store && type == STORE))
     expected_tag |= TLB_CHECK_TRIGGERS;
 
-  if (pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
+  // fetches are traced through the icache instead
+  reg_t page = paddr & ~reg_t(PGSIZE - 1);
+  if (type != FETCH && tracer.interested_in_range(page, page + PGSIZE, type))
+    expected_tag |= TLB_TRACE;
+
+  // PMP homogeneity is checked at the granularity of the mapping: a page
+  // inside a superpage that is homogeneous throughout needs no check.
+  bool homogeneous = false;
+  if (proc) {
+    if (auto e = stlb_lookup(vaddr >> PGSHIFT, stlb_asid()))
+      homogeneous = e->pmp_homogeneous && paddr - e->paddr < (PGSIZE << e->vpn_shift);
+  }
+  if (homogeneous || pmp_homogeneous(paddr & ~reg_t(PGSIZE - 1), PGSIZE)) {
     if (type == FETCH) tlb_insn_tag[idx] = expected_tag;
     else if (type == STORE) tlb_store_tag[idx] = expected_tag;
     else tlb_load_tag[idx] = expected_tag;
@@ -180,11 +552,83 @@ tlb_entry_t mmu_t::refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_
   return entry;
 }
 
+static unsigned pmp_perm_bit(access_type type, reg_t mode)
+{
+  return 1 << (type + 3 * (mode == PRV_M));
+}
+
+pmp_cache_entry_t* mmu_t::pmp_cache_lookup(reg_t ppn)
+{
+  pmp_cache_entry_t* e = &pmp_cache[ppn % PMP_CACHE_ENTRIES];
+  if (likely(e->ppn == ppn))
+    return e;
+
+  // Collect the page offsets at which some PMP region begins or ends.
+  reg_t page = ppn << PGSHIFT;
+  reg_t base = 0;
+  e->nsegs = 0;
+  e->start[e->nsegs++] = 0;
+  for (size_t i = 0; i < proc->state.n_pmp; i++) {
+    reg_t tor = proc->state.pmpaddr[i] << PMP_SHIFT;
+    uint8_t cfg = proc->state.pmpcfg[i];
+
+    // an empty TOR region matches nothing, so splits nothing
+    bool is_tor = (cfg & PMP_A) == PMP_TOR;
+    if ((cfg & PMP_A) && !(is_tor && tor <= base)) {
+      reg_t lo = base, hi = tor;
+      if (!is_tor) {
+        reg_t mask = (proc->state.pmpaddr[i] << 1) | ((cfg & PMP_A) != PMP_NA4);
+        mask = ~(mask & ~(mask + 1)) << PMP_SHIFT;
+        lo = tor & mask;
+        hi = lo - mask;
+      }
+      for (reg_t bound : {lo, hi}) {
+        if (bound > page && bound < page + PGSIZE)
+          e->start[e->nsegs++] = bound - page;
+      }
+    }
+
+    base = tor;
+  }
+  std::sort(e->start, e->start + e->nsegs);
+  e->nsegs = std::unique(e->start, e->start + e->nsegs) - e->start;
+
+  for (unsigned i = 0; i < e->nsegs; i++) {
+    e->perms[i] = 0;
+    for (reg_t mode : {PRV_U, PRV_M}) {
+      for (access_type type : {LOAD, STORE, FETCH}) {
+        if (pmp_check(page + e->start[i], 1, type, mode))
+          e->perms[i] |= pmp_perm_bit(type, mode);
+      }
+    }
+  }
+
+  e->ppn = ppn;
+  return e;
+}
+
 reg_t mmu_t::pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode)
 {
   if (!proc)
     return true;
 
+  // Accesses that cross a segment (or page) boundary are rare, and go
+  // through the full check so that partial matches fail as they should.
+  reg_t offset = addr & (PGSIZE - 1);
+  if (offset + len <= PGSIZE) {
+    pmp_cache_entry_t* e = pmp_cache_lookup(addr >> PGSHIFT);
+    unsigned i = e->nsegs - 1;
+    while (e->start[i] > offset)
+      i--;
+    if (i + 1 == e->nsegs || offset + len <= e->start[i + 1])
+      return (e->perms[i] & pmp_perm_bit(type, mode)) != 0;
+  }
+
+  return pmp_check(addr, len, type, mode);
+}
+
+reg_t mmu_t::pmp_check(reg_t addr, reg_t len, access_type type, reg_t mode)
+{
   reg_t base = 0;
   for (size_t i = 0; i < proc->state.n_pmp; i++) {
     reg_t tor = proc->state.pmpaddr[i] << PMP_SHIFT;
@@ -236,6 +680,9 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   if (!proc)
     return true;
 
+  if (len == PGSIZE)
+    return pmp_cache_lookup(addr >> PGSHIFT)->nsegs == 1;
+
   reg_t base = 0;
   for (size_t i = 0; i < proc->state.n_pmp; i++) {
     reg_t tor = proc->state.pmpaddr[i] << PMP_SHIFT;
@@ -267,11 +714,25 @@ reg_t mmu_t::pmp_homogeneous(reg_t addr, reg_t len)
   return true;
 }
 
-reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
+// Whether a leaf PTE permits an access, ignoring its A and D bits.
+static bool leaf_pte_permits(reg_t pte, access_type type, bool s_mode, bool sum, bool mxr)
+{
+  if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode)
+    return false;
+  if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W)))
+    return false;
+  return type == FETCH ? (pte & PTE_X) :
+         type == LOAD ?  (pte & PTE_R) || (mxr && (pte & PTE_X)) :
+                         (pte & PTE_R) && (pte & PTE_W);
+}
+
+bool mmu_t::walk(reg_t addr, access_type type, reg_t mode, reg_t* paddr, reg_t* cause)
 {
   vm_info vm = decode_vm_info(proc->max_xlen, mode, proc->get_state()->satp);
-  if (vm.levels == 0)
-    return addr & ((reg_t(2) << (proc->xlen-1))-1); // zero-extend from xlen
+  if (vm.levels == 0) {
+    *paddr = addr & ((reg_t(2) << (proc->xlen-1))-1); // zero-extend from xlen
+    return true;
+  }
 
   bool s_mode = mode == PRV_S;
   bool sum = get_field(proc->state.mstatus, MSTATUS_SUM);
@@ -284,40 +745,73 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
   if (masked_msbs != 0 && masked_msbs != mask)
     vm.levels = 0;
 
+  // A second-level TLB hit is only used if the access would succeed without
+  // updating A/D; anything else re-walks the page table in memory.
+  reg_t vpn = addr >> PGSHIFT;
+  reg_t asid = stlb_asid();
+  reg_t ad = PTE_A | ((type == STORE) * PTE_D);
+  if (vm.levels > 0) {
+    if (auto e = stlb_lookup(vpn, asid)) {
+      if (leaf_pte_permits(e->pte, type, s_mode, sum, mxr) && (e->pte & ad) == ad) {
+        *paddr = e->paddr | ((vpn & ((reg_t(1) << e->vpn_shift) - 1)) << PGSHIFT);
+        leaf_shift = std::max(leaf_shift, e->vpn_shift);
+        return true;
+      }
+    }
+  }
+
+  // Start from the deepest non-leaf PTE in the page-walk cache, if any.
+  bool global = false;
   reg_t base = vm.ptbase;
-  for (int i = vm.levels - 1; i >= 0; i--) {
+  int start = vm.levels - 1;
+  for (int i = 1; i < vm.levels && i <= (int)PWC_LEVELS; i++) {
+    reg_t tag = vpn >> (i * vm.idxbits);
+    pwc_entry_t* e = &pwc[i - 1][tag % PWC_ENTRIES];
+    if (e->valid && e->tag == tag && (e->global || e->asid == asid)) {
+      global = e->global;
+      base = e->base;
+      start = i - 1;
+      break;
+    }
+  }
+
+  for (int i = start; i >= 0; i--) {
     int ptshift = i * vm.idxbits;
     reg_t idx = (addr >> (PGSHIFT + ptshift)) & ((1 << vm.idxbits) - 1);
 
     // check that physical address of PTE is legal
     auto pte_paddr = base + idx * vm.ptesize;
     auto ppte = sim->addr_to_mem(pte_paddr);
-    if (!ppte || !pmp_ok(pte_paddr, vm.ptesize, LOAD, PRV_S))
-      throw_access_exception(addr, type);
+    if (!ppte || !pmp_ok(pte_paddr, vm.ptesize, LOAD, PRV_S)) {
+      *cause = access_fault_cause(type);
+      return false;
+    }
 
     reg_t pte = vm.ptesize == 4 ? from_le(*(uint32_t*)ppte) : from_le(*(uint64_t*)ppte);
     reg_t ppn = pte >> PTE_PPN_SHIFT;
+    if (pte & PTE_G)
+      global = true;
 
     if (PTE_TABLE(pte)) { // next level of page table
       base = ppn << PGSHIFT;
-    } else if ((pte & PTE_U) ? s_mode && (type == FETCH || !sum) : !s_mode) {
-      break;
-    } else if (!(pte & PTE_V) || (!(pte & PTE_R) && (pte & PTE_W))) {
-      break;
-    } else if (type == FETCH ? !(pte & PTE_X) :
-               type == LOAD ?  !(pte & PTE_R) && !(mxr && (pte & PTE_X)) :
-                               !((pte & PTE_R) && (pte & PTE_W))) {
+      if (i > 0 && i <= (int)PWC_LEVELS) {
+        reg_t tag = vpn >> ptshift;
+        pwc[i - 1][tag % PWC_ENTRIES] = {true, global, asid, tag, base};
+      }
+    } else if (!leaf_pte_permits(pte, type, s_mode, sum, mxr)) {
       break;
     } else if ((ppn & ((reg_t(1) << ptshift) - 1)) != 0) {
       break;
     } else {
-      reg_t ad = PTE_A | ((type == STORE) * PTE_D);
 #ifdef RISCV_ENABLE_DIRTY
       // set accessed and possibly dirty bits.
       if ((pte & ad) != ad) {
-        if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S))
-          throw_access_exception(addr, type);
+        if (!pmp_ok(pte_paddr, vm.ptesize, STORE, PRV_S)) {
+          *cause = access_fault_cause(type);
+          return false;
+        }
         *(uint32_t*)ppte |= to_le((uint32_t)ad);
+        pte |= ad;
       }
 #else
       // take exception if access or possibly dirty bit is not set.
@@ -325,22 +819,20 @@ reg_t mmu_t::walk(reg_t addr, access_type type, reg_t mode)
         break;
 #endif
       // for superpage mappings, make a fake leaf PTE for the TLB's benefit.
-      reg_t vpn = addr >> PGSHIFT;
-      reg_t value = (ppn | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
-      return value;
+      *paddr = (ppn | (vpn & ((reg_t(1) << ptshift) - 1))) << PGSHIFT;
+      stlb_insert(vpn, ptshift, asid, global, pte, ppn << PGSHIFT);
+      leaf_shift = std::max(leaf_shift, unsigned(ptshift));
+      return true;
     }
   }
 
-  switch (type) {
-    case FETCH: throw trap_instruction_page_fault(addr);
-    case LOAD: throw trap_load_page_fault(addr);
-    case STORE: throw trap_store_page_fault(addr);
-    default: abort();
-  }
+  *cause = page_fault_cause(type);
+  return false;
 }
 
 void mmu_t::register_memtracer(memtracer_t* t)
 {
   flush_tlb();
   tracer.hook(t);
+  trace_fetch = tracer.interested_in_range(0, reg_t(-1), FETCH);
 }
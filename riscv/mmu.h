@@ -15,6 +15,8 @@
 #include "cachesim.h"
 #include "byteorder.h"
 #include <stdlib.h>
+#include <algorithm>
+#include <memory>
 #include <vector>
 
 // virtual memory configuration
@@ -33,6 +35,18 @@ struct icache_entry_t {
   reg_t tag;
   struct icache_entry_t* next;
   insn_fetch_t data;
+  reg_t trace_paddr; // physical address to trace fetches at, or -1
+  uint64_t* count;   // execution counter for spike -g, or NULL
+};
+
+// a straight-line run of decoded instructions starting at tag, ending at the
+// first control-transfer or system instruction (or at a page boundary)
+struct block_cache_entry_t {
+  static const size_t MAX_INSNS = 32;
+  reg_t tag;
+  size_t length;
+  insn_fetch_t insns[MAX_INSNS];
+  uint64_t* counts[MAX_INSNS];
 };
 
 struct tlb_entry_t {
@@ -40,6 +54,49 @@ struct tlb_entry_t {
   reg_t target_offset;
 };
 
+// An entry in the set-associative second-level TLB, which caches the leaf
+// PTEs found by page-table walks. Permissions are rechecked on every hit, so
+// entries survive privilege and mstatus changes; they are tagged by ASID (or
+// marked global), so they also survive satp writes. A superpage is cached as
+// a single entry covering 2^vpn_shift pages: vpn and paddr are those of the
+// whole mapping.
+struct stlb_entry_t {
+  bool valid;
+  bool global;
+  bool pmp_homogeneous; // PMP is uniform across the whole superpage
+  unsigned vpn_shift;
+  reg_t asid;
+  reg_t vpn;
+  reg_t pte;
+  reg_t paddr;
+};
+
+// An entry in the page-walk cache, which holds non-leaf PTEs so that a walk
+// can start at the deepest level it has seen for an address. tag is the VPN
+// without the bits that index the levels below, and base is the physical
+// address of the next-level page table. Like the second-level TLB,
+// entries are tagged by ASID (or marked global) and flushed along with it.
+struct pwc_entry_t {
+  bool valid;
+  bool global;
+  reg_t asid;
+  reg_t tag;
+  reg_t base;
+};
+
+// The PMP decisions for one physical page. The page is split into segments
+// at every PMP region boundary inside it, so each PMP entry matches either
+// all of a segment or none of it, and any access contained in a segment gets
+// that segment's answer. perms holds a bit per access type for M-mode and
+// another for the less privileged modes, which PMP treats alike.
+struct pmp_cache_entry_t {
+  static const size_t MAX_SEGMENTS = 2 * state_t::n_pmp + 1;
+  reg_t ppn;
+  unsigned nsegs;
+  uint16_t start[MAX_SEGMENTS]; // page offsets, ascending from 0
+  uint8_t perms[MAX_SEGMENTS];
+};
+
 class trigger_matched_t
 {
   public:
@@ -53,6 +110,9 @@ class trigger_matched_t
     reg_t data;
 };
 
+// assemble a little-endian value of len <= 8 bytes
+reg_t reg_from_bytes(size_t len, const uint8_t* bytes);
+
 // this class implements a processor's port into the virtual memory system.
 // an MMU and instruction cache are maintained for simulator performance.
 class mmu_t
@@ -61,13 +121,33 @@ public:
   mmu_t(simif_t* sim, processor_t* proc);
   ~mmu_t();
 
+#ifndef RISCV_ENABLE_COMMITLOG
+# define READ_MEM(addr, size) ({})
+#else
+# define READ_MEM(addr, size) \
+  ({ if (proc->get_log_commits()) \
+       proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size)); })
+#endif
+
+#ifndef RISCV_ENABLE_COMMITLOG
+# define WRITE_MEM(addr, value, size) ({})
+#else
+# define WRITE_MEM(addr, val, size) \
+  ({ if (proc->get_log_commits()) \
+       proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size)); })
+#endif
+
+  // A misaligned access within a page is made with one translation; one
+  // that crosses a page boundary is split there, into two.
   inline reg_t misaligned_load(reg_t addr, size_t size, reg_t *paddr)
   {
 #ifdef RISCV_ENABLE_MISALIGNED
-    reg_t res = 0;
-    for (size_t i = 0; i < size; i++)
-      res += (reg_t)load_uint8(addr + i, i == 0 ? paddr : NULL) << (i * 8);
-    return res;
+    uint8_t bytes[sizeof(reg_t)];
+    size_t first = std::min<size_t>(size, PGSIZE - (addr & (PGSIZE - 1)));
+    load_bytes(addr, first, bytes, paddr);
+    if (first < size)
+      load_bytes(addr + first, size - first, bytes + first, NULL);
+    return reg_from_bytes(size, bytes);
 #else
     throw trap_load_address_misaligned(addr);
 #endif
@@ -76,8 +156,14 @@ public:
   inline void misaligned_store(reg_t addr, reg_t data, size_t size, reg_t *paddr)
   {
 #ifdef RISCV_ENABLE_MISALIGNED
+    uint8_t bytes[sizeof(reg_t)];
     for (size_t i = 0; i < size; i++)
-      store_uint8(addr + i, data >> (i * 8), i == 0 ? paddr : NULL);
+      bytes[i] = data >> (i * 8);
+    size_t first = std::min<size_t>(size, PGSIZE - (addr & (PGSIZE - 1)));
+    if (proc) WRITE_MEM(addr, data, size);
+    store_bytes(addr, first, bytes, paddr);
+    if (first < size)
+      store_bytes(addr + first, size - first, bytes + first, NULL);
 
     if (proc) {
       if (proc->rvfi_dii) {
@@ -91,13 +177,6 @@ public:
 #endif
   }
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define READ_MEM(addr, size) ({})
-#else
-# define READ_MEM(addr, size) \
-  proc->state.log_mem_read.push_back(std::make_tuple(addr, 0, size));
-#endif
-
   // template for functions that load an aligned value from memory
 
   #define misaligned_load_uint \
@@ -118,11 +197,13 @@ public:
           *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr; \
         goto success_load; \
       } \
-      if (unlikely(tlb_load_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
+      if (unlikely((tlb_load_tag[vpn % TLB_ENTRIES] & ~(TLB_CHECK_TRIGGERS | TLB_TRACE)) == vpn)) { \
         data = *(type##_t*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr); \
         if (paddr) \
           *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr; \
-        if (!matched_trigger) { \
+        if (tlb_load_tag[vpn % TLB_ENTRIES] & TLB_TRACE) \
+          trace_access(tlb_data[vpn % TLB_ENTRIES].target_offset + addr, size, LOAD); \
+        if ((tlb_load_tag[vpn % TLB_ENTRIES] & TLB_CHECK_TRIGGERS) && !matched_trigger) { \
           matched_trigger = trigger_exception(OPERATION_LOAD, addr, (intval_expr)); \
           if (matched_trigger) \
             throw *matched_trigger; \
@@ -169,13 +250,6 @@ public:
   #undef load_func_impl
   #undef misaligned_load_uint
 
-#ifndef RISCV_ENABLE_COMMITLOG
-# define WRITE_MEM(addr, value, size) ({})
-#else
-# define WRITE_MEM(addr, val, size) \
-  proc->state.log_mem_write.push_back(std::make_tuple(addr, val, size));
-#endif
-
   // template for functions that store an aligned value to memory
 
   #define misaligned_store_uint \
@@ -194,8 +268,8 @@ public:
         if (paddr) \
           *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr; \
       } \
-      else if (unlikely(tlb_store_tag[vpn % TLB_ENTRIES] == (vpn | TLB_CHECK_TRIGGERS))) { \
-        if (!matched_trigger) { \
+      else if (unlikely((tlb_store_tag[vpn % TLB_ENTRIES] & ~(TLB_CHECK_TRIGGERS | TLB_TRACE)) == vpn)) { \
+        if ((tlb_store_tag[vpn % TLB_ENTRIES] & TLB_CHECK_TRIGGERS) && !matched_trigger) { \
           matched_trigger = trigger_exception(OPERATION_STORE, addr, (intval_expr)); \
           if (matched_trigger) \
             throw *matched_trigger; \
@@ -204,6 +278,8 @@ public:
         *(type##_t*)(tlb_data[vpn % TLB_ENTRIES].host_offset + addr) = to_le(val); \
         if (paddr) \
           *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr; \
+        if (tlb_store_tag[vpn % TLB_ENTRIES] & TLB_TRACE) \
+          trace_access(tlb_data[vpn % TLB_ENTRIES].target_offset + addr, size, STORE); \
       } \
       else { \
         if (proc) WRITE_MEM(addr, val, size); \
@@ -222,12 +298,34 @@ public:
   #define store_func(type) \
     store_func_impl(type, val, sizeof(val), misaligned_store_uint)
 
-  // template for functions that perform an atomic memory operation
+  // template for functions that perform an atomic memory operation. The
+  // address is translated once, for a store, which also checks that loads
+  // are permitted; MMIO and traced or watched pages take the slow path.
   #define amo_func(type) \
     template<typename op> \
     type##_t amo_##type(reg_t addr, op f) { \
       if (addr & (sizeof(type##_t)-1)) \
         throw trap_store_address_misaligned(addr); \
+      if (auto host_addr = (type##_t*)amo_host_addr(addr, sizeof(type##_t))) { \
+        type##_t lhs, rhs; \
+        if (unlikely(host_atomics)) { \
+          /* other harts may be running on other host threads */ \
+          lhs = __atomic_load_n(host_addr, __ATOMIC_RELAXED); \
+          do { \
+            rhs = to_le(f(from_le(lhs))); \
+          } while (!__atomic_compare_exchange_n(host_addr, &lhs, rhs, true, \
+                                                __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)); \
+        } else { \
+          lhs = *host_addr; \
+          rhs = to_le(f(from_le(lhs))); \
+          *host_addr = rhs; \
+        } \
+        if (proc) { \
+          READ_MEM(addr, sizeof(type##_t)); \
+          WRITE_MEM(addr, from_le(rhs), sizeof(type##_t)); \
+        } \
+        return from_le(lhs); \
+      } \
       try { \
         auto lhs = load_##type(addr); \
         store_##type(addr, f(lhs)); \
@@ -276,19 +374,91 @@ public:
   #undef store_func_impl
   #undef misaligned_store_uint
 
+  // Returns the host address of the page containing addr if accesses of the
+  // given type to it may bypass load_*/store_*: the page is in the TLB and
+  // in RAM, and no trigger, tracer or rvfi_dii needs to see each access.
+  // Vector memory instructions use this to translate once per page; the
+  // first access to each page must go through load_*/store_* so that it
+  // faults and refills the TLB as usual.
+  inline char* direct_page(reg_t addr, access_type type)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    reg_t tag = type == STORE ? tlb_store_tag[vpn % TLB_ENTRIES] : tlb_load_tag[vpn % TLB_ENTRIES];
+    if (unlikely(tag != vpn || (proc && proc->rvfi_dii)))
+      return NULL;
+    return tlb_data[vpn % TLB_ENTRIES].host_offset + (addr & PGMASK);
+  }
+
+  // record n consecutive accesses of size bytes made through direct_page()
+  inline void log_direct_loads(reg_t addr, reg_t n, size_t size)
+  {
+    if (proc) {
+      for (reg_t i = 0; i < n; i++)
+        READ_MEM(addr + i * size, size);
+    }
+  }
+
+  // (data is in host byte order)
+  template<class T>
+  inline void log_direct_stores(reg_t addr, reg_t n, const T* data)
+  {
+    if (proc) {
+      for (reg_t i = 0; i < n; i++)
+        WRITE_MEM(addr + i * sizeof(T), data[i], sizeof(T));
+    }
+  }
+
   // perform an atomic memory operation at an aligned address
   amo_func(uint32)
   amo_func(uint64)
 
   #undef amo_func
 
+  // LR remembers the value it loaded so that, when harts run concurrently,
+  // SC only succeeds if memory still holds it
+  #define load_reserved_func(type) \
+    type##_t load_reserved_##type(reg_t addr) { \
+      acquire_load_reservation(addr); \
+      type##_t data = load_##type(addr); \
+      load_reservation_value = data; \
+      return data; \
+    }
+
+  #define store_conditional_func(type) \
+    bool store_conditional_##type(reg_t addr, type##_t val) { \
+      bool success = check_load_reservation(addr); \
+      bool check_value = success && host_atomics; \
+      amo_##type(addr, [&](type##_t lhs) { \
+        if (check_value) \
+          success = lhs == (type##_t)load_reservation_value; \
+        return success ? val : lhs; \
+      }); \
+      yield_load_reservation(); \
+      return success; \
+    }
+
+  load_reserved_func(int32)
+  load_reserved_func(int64)
+  store_conditional_func(uint32)
+  store_conditional_func(uint64)
+
+  #undef load_reserved_func
+  #undef store_conditional_func
+
   inline void yield_load_reservation()
   {
     load_reservation_address = (reg_t)-1;
   }
 
+  // A TLB entry without TLB_CHECK_TRIGGERS always maps RAM, so a hit needs
+  // no translation.
   inline void acquire_load_reservation(reg_t vaddr)
   {
+    reg_t vpn = vaddr >> PGSHIFT;
+    if (likely(tlb_load_tag[vpn % TLB_ENTRIES] == vpn)) {
+      load_reservation_address = tlb_data[vpn % TLB_ENTRIES].target_offset + vaddr;
+      return;
+    }
     reg_t paddr = translate(vaddr, 1, LOAD);
     if (auto host_addr = sim->addr_to_mem(paddr))
       load_reservation_address = refill_tlb(vaddr, paddr, host_addr, LOAD).target_offset + vaddr;
@@ -298,6 +468,9 @@ public:
 
   inline bool check_load_reservation(reg_t vaddr)
   {
+    reg_t vpn = vaddr >> PGSHIFT;
+    if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn))
+      return load_reservation_address == tlb_data[vpn % TLB_ENTRIES].target_offset + vaddr;
     reg_t paddr = translate(vaddr, 1, STORE);
     if (auto host_addr = sim->addr_to_mem(paddr))
       return load_reservation_address == refill_tlb(vaddr, paddr, host_addr, STORE).target_offset + vaddr;
@@ -316,9 +489,11 @@ public:
     return (addr / PC_ALIGN) % ICACHE_ENTRIES;
   }
 
-  inline icache_entry_t* refill_icache(reg_t addr, icache_entry_t* entry)
+  // check_fetch is false when the fetch is speculative (block cache fill),
+  // in which case the extension's fetch checks are deferred to execution.
+  inline icache_entry_t* refill_icache(reg_t addr, icache_entry_t* entry, bool check_fetch = true)
   {
-    auto *ext = proc->get_extension();
+    auto *ext = check_fetch ? proc->get_extension() : NULL;
     if (ext) ext->check_ifetch_granule(addr, addr);
 
     auto tlb_entry = translate_insn_addr(addr);
@@ -349,43 +524,129 @@ public:
     entry->tag = addr;
     entry->next = &icache[icache_index(addr + length)];
     entry->data = fetch;
+    entry->count = proc->profile_counter(addr, fetch.insn);
 
-    reg_t paddr = tlb_entry.target_offset + addr;;
-    if (tracer.interested_in_range(paddr, paddr + 1, FETCH)) {
-      entry->tag = -1;
-      tracer.trace(paddr, length, FETCH);
-    }
+    reg_t paddr = tlb_entry.target_offset + addr;
+    entry->trace_paddr = -1;
+    if (unlikely(trace_fetch) && tracer.interested_in_range(paddr, paddr + 1, FETCH))
+      entry->trace_paddr = paddr;
     return entry;
   }
 
+  // Fetches are traced as each instruction is executed from the icache,
+  // so that the icache can stay in use while fetches are traced.
+  inline void trace_insn_fetch(icache_entry_t* entry)
+  {
+    if (unlikely(trace_fetch) && entry->trace_paddr != reg_t(-1))
+      trace_access(entry->trace_paddr, entry->data.insn.length(), FETCH);
+  }
+
+  // Fetches from within the extension's fetch bounds, as of the last fetch
+  // that was fully checked, cannot fail its checks.
+  inline void check_ifetch(reg_t addr, insn_t insn)
+  {
+    if (likely(addr >= fetch_lo && addr + insn.length() <= fetch_hi))
+      return;
+    check_ifetch_slow(addr, insn);
+  }
+
+  // Must be called whenever the extension's fetch bounds may have changed.
+  void flush_fetch_bounds()
+  {
+    fetch_lo = -1;
+    fetch_hi = 0;
+  }
+
+  // On an icache miss, checks that a fetch from addr translates. If not,
+  // the page or access fault is recorded with the processor and false is
+  // returned, so that step() can take it without throwing.
+  inline bool probe_fetch(reg_t addr)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (likely((tlb_insn_tag[vpn % TLB_ENTRIES] & ~TLB_CHECK_TRIGGERS) == vpn))
+      return true;
+    return probe_fetch_slow(addr);
+  }
+
+  // Returns NULL if the fetch faults; see probe_fetch().
   inline icache_entry_t* access_icache(reg_t addr)
   {
     icache_entry_t* entry = &icache[icache_index(addr)];
     if (likely(entry->tag == addr)) {
-      if (auto *ext = proc->get_extension()) {
-        ext->check_ifetch_granule(addr, addr);
-        for (int i = 2; i < entry->data.insn.length(); i += 2)
-          ext->check_ifetch_granule(addr, addr + i);
-      }
+      check_ifetch(addr, entry->data.insn);
       return entry;
     }
+    if (unlikely(!probe_fetch(addr)))
+      return NULL;
     return refill_icache(addr, entry);
   }
 
+  static const reg_t BLOCK_CACHE_ENTRIES = 256;
+
+  // The block cache sits above the icache. Its entries are not rechecked
+  // against fetch triggers or traced, so it is only used when neither is
+  // active; the caller must call check_ifetch() before executing each insn.
+  inline bool block_cache_usable()
+  {
+    return !check_triggers_fetch && !trace_fetch;
+  }
+
+  // Returns NULL if the fetch faults; see probe_fetch().
+  inline block_cache_entry_t* access_block(reg_t addr)
+  {
+    block_cache_entry_t* block = &block_cache[(addr / PC_ALIGN) % BLOCK_CACHE_ENTRIES];
+    if (likely(block->tag == addr))
+      return block;
+    return refill_block(addr, block);
+  }
+
   inline insn_fetch_t load_insn(reg_t addr)
   {
     icache_entry_t entry;
-    return refill_icache(addr, &entry)->data;
+    trace_insn_fetch(refill_icache(addr, &entry));
+    return entry.data;
   }
 
   void flush_tlb();
   void flush_icache();
 
+  // flush the TLB but keep decoded instructions, for changes that only
+  // affect the permission checks it caches for loads and stores
+  void flush_tlb_tags();
+
+  // Decoded instructions are kept for the last few translation contexts
+  // (privilege and satp), so that returning to a context, as a kernel does
+  // when switching between processes, need not decode its code again.
+  // Must be called whenever the privilege or satp changes; flushes the TLB,
+  // which only holds the current context.
+  void set_translation_context(reg_t prv, reg_t satp);
+
+  // invalidate second-level TLB entries, as sfence.vma would: if has_vaddr,
+  // only those mapping vaddr; if has_asid, only non-global ones for asid
+  void flush_stlb(bool has_vaddr = false, reg_t vaddr = 0,
+                  bool has_asid = false, reg_t asid = 0);
+
+  // sfence.vma: as flush_stlb(), and also invalidate the TLB entries and
+  // decoded instructions that may have come from the same mappings
+  void sfence_vma(bool has_vaddr = false, reg_t vaddr = 0,
+                  bool has_asid = false, reg_t asid = 0);
+  void set_stlb_geometry(size_t sets, size_t ways);
+  void flush_pmp_cache();
+
   void register_memtracer(memtracer_t*);
   void register_l2cache(cache_sim_t* l2) {l2cache = l2;}
-  cache_sim_t *get_l2cache() {return l2cache;}
+  cache_sim_t *get_l2cache() {flush_trace_buffer(); return l2cache;}
 
-  memtracer_list_t *get_tracer() {return &tracer;};
+  memtracer_list_t *get_tracer() {flush_trace_buffer(); return &tracer;};
+
+  // hand the buffered accesses over to the memtracers
+  inline void flush_trace_buffer()
+  {
+    if (trace_buffer_used) {
+      tracer.trace_batch(trace_buffer, trace_buffer_used);
+      trace_buffer_used = 0;
+    }
+  }
 
   int is_dirty_enabled()
   {
@@ -409,29 +670,114 @@ private:
   simif_t* sim;
   processor_t* proc;
   memtracer_list_t tracer;
+
+  // accesses made through the TLB or icache are buffered here, in order,
+  // rather than making virtual calls into the tracers for each of them
+  static const size_t TRACE_BUFFER_ENTRIES = 1024;
+  memtrace_record_t trace_buffer[TRACE_BUFFER_ENTRIES];
+  size_t trace_buffer_used;
+  inline void trace_access(reg_t paddr, size_t bytes, access_type type)
+  {
+    trace_buffer[trace_buffer_used++] = {paddr, uint32_t(bytes), type};
+    if (unlikely(trace_buffer_used == TRACE_BUFFER_ENTRIES))
+      flush_trace_buffer();
+  }
+
   reg_t load_reservation_address;
+  reg_t load_reservation_value;
+  bool host_atomics;
   cache_sim_t *l2cache;
   uint16_t fetch_temp;
 
-  // implement an instruction cache for simulator performance
-  icache_entry_t icache[ICACHE_ENTRIES];
+  // implement an instruction cache for simulator performance, with one
+  // bank per translation context; icache points at the current one
+  struct icache_bank_t {
+    reg_t prv;
+    reg_t satp;       // 0 if the context does not translate
+    reg_t asid;
+    icache_entry_t icache[ICACHE_ENTRIES];
+    block_cache_entry_t block_cache[BLOCK_CACHE_ENTRIES];
+  };
+  static const size_t ICACHE_BANKS = 4;
+  std::vector<std::unique_ptr<icache_bank_t>> icache_banks;
+  size_t icache_victim;
+  icache_entry_t* icache;
+  void flush_icache_bank(icache_bank_t* bank);
+
+  // pre-decoded basic blocks, filled from the icache
+  block_cache_entry_t* block_cache;
+  block_cache_entry_t* refill_block(reg_t addr, block_cache_entry_t* block);
+  bool trace_fetch;
+
+  reg_t fetch_lo, fetch_hi;
+  void check_ifetch_slow(reg_t addr, insn_t insn);
 
   // implement a TLB for simulator performance
   static const reg_t TLB_ENTRIES = 256;
   // If a TLB tag has TLB_CHECK_TRIGGERS set, then the MMU must check for a
   // trigger match before completing an access.
   static const reg_t TLB_CHECK_TRIGGERS = reg_t(1) << 63;
+  // If a load or store TLB tag has TLB_TRACE set, then the access must be
+  // recorded for the memtracers.
+  static const reg_t TLB_TRACE = reg_t(1) << 62;
   tlb_entry_t tlb_data[TLB_ENTRIES];
   reg_t tlb_insn_tag[TLB_ENTRIES];
   reg_t tlb_load_tag[TLB_ENTRIES];
   reg_t tlb_store_tag[TLB_ENTRIES];
 
+  // second-level TLB, consulted by walk()
+  static const size_t STLB_SETS = 512;
+  static const size_t STLB_WAYS = 4;
+  size_t stlb_sets;
+  size_t stlb_ways;
+  std::vector<stlb_entry_t> stlb;
+  std::vector<size_t> stlb_victim;
+  reg_t stlb_shifts; // set of vpn_shift values that may be present
+  unsigned leaf_shift; // largest vpn_shift translated since the last flush
+  reg_t stlb_asid();
+  stlb_entry_t* stlb_lookup(reg_t vpn, reg_t asid);
+  void stlb_insert(reg_t vpn, unsigned vpn_shift, reg_t asid, bool global,
+                   reg_t pte, reg_t paddr);
+
+  // page-walk cache, one direct-mapped table per non-leaf level
+  static const size_t PWC_LEVELS = 5;
+  static const size_t PWC_ENTRIES = 32;
+  pwc_entry_t pwc[PWC_LEVELS][PWC_ENTRIES];
+
+  // copy len bytes, all in one page, for a misaligned access
+  inline void load_bytes(reg_t addr, size_t len, uint8_t* bytes, reg_t* paddr)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (likely(tlb_load_tag[vpn % TLB_ENTRIES] == vpn)) {
+      memcpy(bytes, tlb_data[vpn % TLB_ENTRIES].host_offset + addr, len);
+      if (paddr)
+        *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr;
+    } else {
+      load_slow_path(addr, len, len, bytes, paddr);
+    }
+  }
+
+  inline void store_bytes(reg_t addr, size_t len, const uint8_t* bytes, reg_t* paddr)
+  {
+    reg_t vpn = addr >> PGSHIFT;
+    if (likely(tlb_store_tag[vpn % TLB_ENTRIES] == vpn)) {
+      memcpy(tlb_data[vpn % TLB_ENTRIES].host_offset + addr, bytes, len);
+      if (paddr)
+        *paddr = tlb_data[vpn % TLB_ENTRIES].target_offset + addr;
+    } else {
+      store_slow_path(addr, len, len, bytes, paddr);
+    }
+  }
+
   // finish translation on a TLB miss and update the TLB
   tlb_entry_t refill_tlb(reg_t vaddr, reg_t paddr, char* host_addr, access_type type);
   const char* fill_from_mmio(reg_t vaddr, reg_t paddr);
 
-  // perform a page table walk for a given VA; set referenced/dirty bits
-  reg_t walk(reg_t addr, access_type type, reg_t prv);
+  // perform a page table walk for a given VA; set referenced/dirty bits.
+  // On a fault, returns false and sets *cause instead of throwing.
+  bool walk(reg_t addr, access_type type, reg_t prv, reg_t* paddr, reg_t* cause);
+  bool try_translate(reg_t addr, reg_t len, access_type type, reg_t* paddr, reg_t* cause);
+  bool probe_fetch_slow(reg_t addr);
 
   // handle uncommon cases: TLB misses, page faults, MMIO
   tlb_entry_t fetch_slow_path(reg_t addr);
@@ -507,8 +853,16 @@ private:
     return new trigger_matched_t(match, operation, address, data);
   }
 
+  char* amo_host_addr(reg_t addr, reg_t len);
+
   reg_t pmp_homogeneous(reg_t addr, reg_t len);
   reg_t pmp_ok(reg_t addr, reg_t len, access_type type, reg_t mode);
+  reg_t pmp_check(reg_t addr, reg_t len, access_type type, reg_t mode);
+
+  // per-page PMP decisions, invalidated by writes to the PMP CSRs
+  static const size_t PMP_CACHE_ENTRIES = 64;
+  pmp_cache_entry_t pmp_cache[PMP_CACHE_ENTRIES];
+  pmp_cache_entry_t* pmp_cache_lookup(reg_t ppn);
 
   bool check_triggers_fetch;
   bool check_triggers_load;
@@ -8,6 +8,8 @@
 #include "simif.h"
 #include "mmu.h"
 #include "disasm.h"
+#include "checkpoint.h"
+#include "commitlog.h"
 #include <cinttypes>
 #include <cmath>
 #include <cstdlib>
@@ -27,9 +29,9 @@
 
 processor_t::processor_t(const char* isa, const char* priv, const char* varch,
                          simif_t* sim, uint32_t id, bool halt_on_reset)
-  : debug(false), halt_request(false), sim(sim), ext(NULL), id(id), xlen(0),
+  : debug(false), host_fp(false), halt_request(false), sim(sim), ext(NULL), id(id), xlen(0),
   histogram_enabled(false), log_commits_enabled(false),
-  halt_on_reset(halt_on_reset), last_pc(1), executions(1)
+  halt_on_reset(halt_on_reset), commit_trace(NULL), last_pc(1), executions(1)
 {
   VU.p = this;
   parse_isa_string(isa);
@@ -48,15 +50,6 @@ processor_t::processor_t(const char* isa, const char* priv, const char* varch,
 
 processor_t::~processor_t()
 {
-#ifdef RISCV_ENABLE_HISTOGRAM
-  if (histogram_enabled)
-  {
-    fprintf(stderr, "PC Histogram size:%zu\n", pc_histogram.size());
-    for (auto it : pc_histogram)
-      fprintf(stderr, "%0" PRIx64 " %" PRIu64 "\n", it.first, it.second);
-  }
-#endif
-
   delete mmu;
   delete disassembler;
 }
@@ -347,6 +340,16 @@ void processor_t::set_histogram(bool value)
     abort();
   }
 #endif
+  // decoded instructions pick up their counters when next refilled
+  mmu->flush_icache();
+}
+
+void processor_t::print_profile(const std::map<std::string, uint64_t>& symbols)
+{
+  if (!histogram_enabled)
+    return;
+  fprintf(stderr, "core %3d: ", id);
+  profile.print(stderr, symbols, disassembler);
 }
 
 void processor_t::set_log_commits(bool value)
@@ -361,9 +364,17 @@ void processor_t::set_log_commits(bool value)
 #endif
 }
 
+void processor_t::set_commit_trace(commit_trace_t* trace)
+{
+  set_log_commits(trace != NULL);
+  commit_trace = trace;
+  commit_trace_buf.reserve(commit_trace_t::BUFFER_SIZE);
+}
+
 void processor_t::reset()
 {
   state.reset(max_isa);
+  mmu->set_translation_context(state.prv, state.satp);
 
   state.dcsr.halt = halt_on_reset;
   halt_on_reset = false;
@@ -382,6 +393,100 @@ void processor_t::reset()
     sim->proc_reset(id);
 }
 
+void processor_t::checkpoint(checkpoint_t& cp)
+{
+  cp.check(id, "hart ID");
+  cp.check(max_isa, "ISA");
+
+  cp.field(xlen);
+  cp.field(state.pc);
+  for (size_t i = 0; i < NXPR; i++) {
+    auto x = state.XPR[i];
+    cp.field(x);
+    state.XPR.write(i, x);
+  }
+  for (size_t i = 0; i < NFPR; i++) {
+    auto f = state.FPR[i];
+    cp.field(f);
+    state.FPR.write(i, f);
+  }
+  cp.field(state.prv);
+  cp.field(state.misa);
+  cp.field(state.mstatus);
+  cp.field(state.mepc);
+  cp.field(state.mtval);
+  cp.field(state.mscratch);
+  cp.field(state.mtvec);
+  cp.field(state.mcause);
+  cp.field(state.minstret);
+  cp.field(state.mie);
+  cp.field(state.mip);
+  cp.field(state.medeleg);
+  cp.field(state.mideleg);
+  cp.field(state.mcounteren);
+  cp.field(state.scounteren);
+  cp.field(state.sepc);
+  cp.field(state.stval);
+  cp.field(state.sscratch);
+  cp.field(state.stvec);
+  cp.field(state.satp);
+  cp.field(state.scause);
+  cp.field(state.dpc);
+  cp.field(state.dscratch0);
+  cp.field(state.dscratch1);
+  cp.field(state.dcsr);
+  cp.field(state.tselect);
+  cp.field(state.mcontrol);
+  cp.field(state.tdata2);
+  cp.field(state.debug_mode);
+  cp.field(state.pmpcfg);
+  cp.field(state.pmpaddr);
+  cp.field(state.fflags);
+  cp.field(state.frm);
+  cp.field(state.serialized);
+  cp.field(state.single_step);
+#ifdef RISCV_ENABLE_HPM
+  cp.field(state.mhpmevent);
+  cp.field(state.mhpmcounter);
+  cp.field(state.shpmevent);
+  cp.field(state.shpmcounter);
+#endif
+#ifdef ENABLE_CHERI
+  cp.field(state.mccsr);
+  cp.field(state.sccsr);
+#endif
+
+  cp.check(VU.VLEN, "VLEN");
+  cp.check(VU.ELEN, "ELEN");
+  cp.field(VU.vstart);
+  cp.field(VU.vxrm);
+  cp.field(VU.vxsat);
+  cp.field(VU.vl);
+  cp.field(VU.vtype);
+  cp.field(VU.vlenb);
+  cp.field(VU.vediv);
+  cp.field(VU.vsew);
+  cp.field(VU.vlmul);
+  cp.field(VU.vlmax);
+  cp.field(VU.vmlen);
+  cp.field(VU.reg_mask);
+  cp.field(VU.vill);
+  cp.bytes(VU.reg_file, NVPR * (VU.VLEN / 8));
+
+  cp.check(ext != NULL, "extension");
+  if (ext)
+    ext->checkpoint(cp);
+
+  if (!cp.saving()) {
+    // cached translations and decoded instructions may be stale
+    mmu->yield_load_reservation();
+    mmu->flush_pmp_cache();
+    mmu->flush_stlb();
+    mmu->flush_tlb();
+    mmu->set_translation_context(state.prv, state.satp);
+  }
+}
+
 // Count number of contiguous 0 bits starting from the LSB.
 static int ctz(reg_t val)
 {
@@ -452,8 +557,13 @@ reg_t processor_t::legalize_privilege(reg_t prv)
 
 void processor_t::set_privilege(reg_t prv)
 {
-  mmu->flush_tlb();
-  state.prv = legalize_privilege(prv);
+  // The TLB caches permission checks made at the current privilege, so it
+  // only needs flushing when that changes; traps taken to the mode they
+  // were raised in keep it.
+  prv = legalize_privilege(prv);
+  if (prv != state.prv)
+    mmu->set_translation_context(prv, state.satp);
+  state.prv = prv;
 }
 
 void processor_t::enter_debug_mode(uint8_t cause)
@@ -461,6 +571,8 @@ void processor_t::enter_debug_mode(uint8_t cause)
   state.debug_mode = true;
   state.dcsr.cause = cause;
   state.dcsr.prv = state.prv;
+  // MPRV is ignored in debug mode
+  mmu->flush_tlb();
   set_privilege(PRV_M);
   state.dpc = state.pc;
   state.pc = DEBUG_ROM_ENTRY;
@@ -521,6 +633,7 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
     sepcc.set_cursor(epc);
     cheri->state.scrs_reg_file.write(CHERI_SCR_SEPCC, sepcc);
     cheri->state.scrs_reg_file.write(CHERI_SCR_PCC, cheri->get_scr(CHERI_SCR_STCC, this));
+    cheri->pcc_changed();
 #endif /* ENABLE_CHERI */
     // Must come after CHERI handling to ensure stvec uses new PCC not old
     reg_t vector = (state.stvec & 1) && interrupt ? 4*bit : 0;
@@ -549,6 +662,7 @@ void processor_t::take_trap(trap_t& t, reg_t epc)
     mepcc.set_cursor(epc);
     cheri->state.scrs_reg_file.write(CHERI_SCR_MEPCC, mepcc);
     cheri->state.scrs_reg_file.write(CHERI_SCR_PCC, cheri->get_scr(CHERI_SCR_MTCC, this));
+    cheri->pcc_changed();
 #endif /* ENABLE_CHERI */
     // Must come after CHERI handling to ensure stvec uses new PCC not old
     reg_t vector = (state.mtvec & 1) && interrupt ? 4*bit : 0;
@@ -607,7 +721,9 @@ void processor_t::set_csr(int which, reg_t val)
     if (!locked && !(next_locked && next_tor))
       state.pmpaddr[i] = val & ((reg_t(1) << (MAX_PADDR_BITS - PMP_SHIFT)) - 1);
 
+    mmu->flush_pmp_cache();
     mmu->flush_tlb();
+    mmu->flush_stlb();
   }
 
   if (which >= CSR_PMPCFG0 && which < CSR_PMPCFG0 + state.n_pmp / 4) {
@@ -618,7 +734,9 @@ void processor_t::set_csr(int which, reg_t val)
         state.pmpcfg[i] = cfg;
       }
     }
+    mmu->flush_pmp_cache();
     mmu->flush_tlb();
+    mmu->flush_stlb();
   }
 
   switch (which)
@@ -641,9 +759,13 @@ void processor_t::set_csr(int which, reg_t val)
       }
       break;
     case CSR_MSTATUS: {
-      if ((val ^ state.mstatus) &
-          (MSTATUS_MPP | MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR))
-        mmu->flush_tlb();
+      // MPP only affects translation while MPRV is set, which saves a flush
+      // on every trap and return. None of these affect fetches, so decoded
+      // instructions are kept.
+      reg_t changed = val ^ state.mstatus;
+      if ((changed & (MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)) ||
+          ((changed & MSTATUS_MPP) && ((val | state.mstatus) & MSTATUS_MPRV)))
+        mmu->flush_tlb_tags();
 
       bool has_fs = supports_extension('S') || supports_extension('F')
                   || supports_extension('V');
@@ -680,8 +802,11 @@ void processor_t::set_csr(int which, reg_t val)
       break;
     }
     case CSR_MIP: {
+      // MSIP and MTIP may be updated concurrently by the CLINT when harts
+      // run on separate host threads, so only touch the writable bits.
       reg_t mask = supervisor_ints & (MIP_SSIP | MIP_STIP);
-      state.mip = (state.mip & ~mask) | (val & mask);
+      __atomic_fetch_or(&state.mip, val & mask, __ATOMIC_RELAXED);
+      __atomic_fetch_and(&state.mip, ~(mask & ~val), __ATOMIC_RELAXED);
       break;
     }
     case CSR_MIE:
@@ -742,13 +867,26 @@ void processor_t::set_csr(int which, reg_t val)
                      (state.mie & ~state.mideleg) | (val & state.mideleg));
     case CSR_SATP: {
       reg_t rv64_ppn_mask = (reg_t(1) << (MAX_PADDR_BITS - PGSHIFT)) - 1;
-      mmu->flush_tlb();
+      reg_t old_satp = state.satp;
       if (max_xlen == 32)
-        state.satp = val & (SATP32_PPN | SATP32_MODE);
+        state.satp = val & (SATP32_PPN | SATP32_ASID | SATP32_MODE);
       if (max_xlen == 64 && (get_field(val, SATP64_MODE) == SATP_MODE_OFF ||
                              get_field(val, SATP64_MODE) == SATP_MODE_SV39 ||
                              get_field(val, SATP64_MODE) == SATP_MODE_SV48))
-        state.satp = val & (SATP64_PPN | SATP64_MODE | rv64_ppn_mask);
+        state.satp = val & (SATP64_PPN | SATP64_ASID | SATP64_MODE | rv64_ppn_mask);
+
+      // The second-level TLB and the decoded instructions are kept per
+      // ASID, so they survive switching address spaces. Drop them if the
+      // mode changes, and drop the ASID's if it is reused for a different
+      // page table.
+      reg_t mode_mask = max_xlen == 32 ? SATP32_MODE : SATP64_MODE;
+      reg_t asid_mask = max_xlen == 32 ? SATP32_ASID : SATP64_ASID;
+      if ((old_satp ^ state.satp) & mode_mask)
+        mmu->sfence_vma();
+      else if (!((old_satp ^ state.satp) & asid_mask) && old_satp != state.satp)
+        mmu->sfence_vma(false, 0, true, get_field(state.satp, asid_mask));
+      if (old_satp != state.satp)
+        mmu->set_translation_context(state.prv, state.satp);
       break;
     }
     case CSR_SEPC: state.sepc = val & ~(reg_t)1; break;
@@ -1062,34 +1200,20 @@ reg_t processor_t::get_csr(int which)
 
 reg_t illegal_instruction(processor_t* p, insn_t insn, reg_t pc)
 {
-  throw trap_illegal_instruction(0);
+  return p->defer_trap(trap_illegal_instruction(0));
 }
 
 insn_func_t processor_t::decode_insn(insn_t insn)
 {
-  // look up opcode in hash table
-  size_t idx = insn.bits() % OPCODE_CACHE_SIZE;
-  insn_desc_t desc = opcode_cache[idx];
-
-  if (unlikely(insn.bits() != desc.match)) {
-    // fall back to linear search
-    insn_desc_t* p = &instructions[0];
-    while ((insn.bits() & p->mask) != p->match)
-      p++;
-    desc = *p;
-
-    if (p->mask != 0 && p > &instructions[0]) {
-      if (p->match != (p-1)->match && p->match != (p+1)->match) {
-        // move to front of opcode list to reduce miss penalty
-        while (--p >= &instructions[0])
-          *(p+1) = *p;
-        instructions[0] = desc;
-      }
-    }
+  insn_bits_t bits = insn.bits();
+  const decode_node_t* node = &decode_nodes[0];
+  while (node->width)
+    node = &decode_nodes[node->first + ((bits >> node->shift) & ((1 << node->width) - 1))];
 
-    opcode_cache[idx] = desc;
-    opcode_cache[idx].match = insn.bits();
-  }
+  const uint16_t* i = &decode_leaves[node->first];
+  while ((bits & instructions[*i].mask) != instructions[*i].match)
+    i++;
+  const insn_desc_t& desc = instructions[*i];
 
   return xlen == 64 ? desc.rv64 : desc.rv32;
 }
@@ -1099,8 +1223,54 @@ void processor_t::register_insn(insn_desc_t desc)
   instructions.push_back(desc);
 }
 
+// The fields the decode tree splits on, in order: the major opcode, the
+// bits holding funct3 (bits 15:13 for compressed instructions), funct7 and
+// rs2.
+static const struct {
+  uint8_t shift, width;
+} decode_fields[] = {{0, 7}, {12, 4}, {25, 7}, {20, 5}};
+
+void processor_t::build_decode_node(size_t node, const std::vector<uint16_t>& candidates, size_t level,
+                                    std::map<std::vector<uint16_t>, uint32_t>& leaves)
+{
+  const size_t nfields = sizeof(decode_fields) / sizeof(decode_fields[0]);
+  for (; level < nfields && candidates.size() > DECODE_LEAF_SIZE; level++) {
+    auto field = decode_fields[level];
+    insn_bits_t field_mask = ((insn_bits_t(1) << field.width) - 1) << field.shift;
+    std::vector<std::vector<uint16_t>> children(size_t(1) << field.width);
+    size_t largest = 0;
+    for (size_t v = 0; v < children.size(); v++) {
+      insn_bits_t field_bits = insn_bits_t(v) << field.shift;
+      for (auto i : candidates)
+        if (((instructions[i].match ^ field_bits) & instructions[i].mask & field_mask) == 0)
+          children[v].push_back(i);
+      largest = std::max(largest, children[v].size());
+    }
+
+    // skip fields that do not tell any of the candidates apart
+    if (largest == candidates.size())
+      continue;
+
+    size_t first = decode_nodes.size();
+    decode_nodes[node] = {(uint32_t)first, field.shift, field.width};
+    decode_nodes.resize(first + children.size());
+    for (size_t v = 0; v < children.size(); v++)
+      build_decode_node(first + v, children[v], level + 1, leaves);
+    return;
+  }
+
+  // identical leaves are shared
+  auto it = leaves.find(candidates);
+  if (it == leaves.end()) {
+    it = leaves.insert(std::make_pair(candidates, (uint32_t)decode_leaves.size())).first;
+    decode_leaves.insert(decode_leaves.end(), candidates.begin(), candidates.end());
+  }
+  decode_nodes[node] = {it->second, 0, 0};
+}
+
 void processor_t::build_opcode_map()
 {
+  // When several instructions match, the first in this order wins.
   struct cmp {
     bool operator()(const insn_desc_t& lhs, const insn_desc_t& rhs) {
       if (lhs.match == rhs.match)
@@ -1110,8 +1280,15 @@ void processor_t::build_opcode_map()
   };
   std::sort(instructions.begin(), instructions.end(), cmp());
 
-  for (size_t i = 0; i < OPCODE_CACHE_SIZE; i++)
-    opcode_cache[i] = {0, 0, &illegal_instruction, &illegal_instruction};
+  assert(instructions.size() <= UINT16_MAX);
+  std::vector<uint16_t> all(instructions.size());
+  for (size_t i = 0; i < all.size(); i++)
+    all[i] = i;
+
+  std::map<std::vector<uint16_t>, uint32_t> leaves;
+  decode_nodes.assign(1, decode_node_t());
+  decode_leaves.clear();
+  build_decode_node(0, all, 0, leaves);
 }
 
 void processor_t::register_extension(extension_t* x)
@@ -14,6 +14,7 @@
 #include <map>
 #include <cassert>
 #include "debug_rom_defines.h"
+#include "profile.h"
 #include <rvfi_dii.h>
 
 class processor_t;
@@ -23,6 +24,7 @@ class simif_t;
 class trap_t;
 class extension_t;
 class disassembler_t;
+class commit_trace_t;
 
 struct insn_desc_t
 {
@@ -32,8 +34,33 @@ struct insn_desc_t
   insn_func_t rv64;
 };
 
-// regnum, data
-typedef std::unordered_map<reg_t, freg_t> commit_log_reg_t;
+// regnum, data: the registers written by the current instruction, in the
+// order they were first written; only recorded while commits are logged,
+// since it is cleared only when an instruction is logged
+class commit_log_reg_t
+{
+public:
+  typedef std::pair<reg_t, freg_t> value_type;
+
+  commit_log_reg_t() : n(0) {}
+  freg_t& operator[](reg_t regnum)
+  {
+    for (size_t i = 0; i < n; i++)
+      if (entries[i].first == regnum)
+        return entries[i].second;
+    entries[n].first = regnum;
+    return entries[n++].second;
+  }
+  const value_type* begin() const { return entries; }
+  const value_type* end() const { return entries + n; }
+  size_t size() const { return n; }
+  void clear() { n = 0; }
+
+private:
+  // each x, f and v register appears at most once
+  value_type entries[NXPR + NFPR + NVPR];
+  size_t n;
+};
 
 // addr, value, size
 typedef std::vector<std::tuple<reg_t, uint64_t, uint8_t>> commit_log_mem_t;
@@ -270,7 +297,13 @@ public:
   void set_histogram(bool value);
   void set_log_commits(bool value);
   bool get_log_commits() { return log_commits_enabled; }
+  void set_host_fp(bool value) { host_fp = value; }
+  // write the commit log to trace in binary form rather than as text
+  void set_commit_trace(commit_trace_t* trace);
+  commit_trace_t* get_commit_trace() { return commit_trace; }
   void reset();
+  // save or restore the architectural state of this hart
+  void checkpoint(checkpoint_t& cp);
   void step(size_t n, insn_t insn = 0x13); // run for n cycles
   void set_csr(int which, reg_t val);
   reg_t get_csr(int which);
@@ -292,13 +325,28 @@ public:
   reg_t pc_alignment_mask() {
     return ~(reg_t)(supports_extension('C') ? 0 : 2);
   }
+  // Records t to be taken once the current instruction returns PC_TRAP,
+  // which is cheaper than throwing it for the most frequent exceptions.
+  reg_t defer_trap(trap_t&& t) {
+    pending_trap = pending_trap_t(t);
+    return PC_TRAP;
+  }
   void check_pc_alignment(reg_t pc) {
     if (unlikely(pc & ~pc_alignment_mask()))
       throw trap_instruction_address_misaligned(pc);
   }
   reg_t legalize_privilege(reg_t);
   void set_privilege(reg_t);
-  void update_histogram(reg_t pc);
+  void update_histogram(reg_t pc, insn_t insn, uint64_t* count);
+  // The execution counter for the instruction at pc, or NULL if the
+  // histogram is off; decoded icache entries cache the result.
+  uint64_t* profile_counter(reg_t pc, insn_t insn)
+  {
+    return histogram_enabled ? profile.counter(pc, insn.bits()) : NULL;
+  }
+  void print_profile(const std::map<std::string, uint64_t>& symbols);
+  void commit_trace_insn(reg_t pc, insn_t insn);
+  void flush_commit_trace();
   const disassembler_t* get_disassembler() { return disassembler; }
 
   void register_insn(insn_desc_t);
@@ -311,6 +359,8 @@ public:
   // When true, display disassembly of each instruction that's executed.
   bool debug;
   bool rvfi_dii;
+  // When true, run common F and D operations on the host FPU (see hostfp.h).
+  bool host_fp;
   // When true, take the slow simulation path.
   bool slow_path();
   bool halted() { return state.debug_mode; }
@@ -414,16 +464,30 @@ private:
   bool histogram_enabled;
   bool log_commits_enabled;
   bool halt_on_reset;
+  commit_trace_t* commit_trace;
+  std::vector<char> commit_trace_buf;
+  pending_trap_t pending_trap;
 
   std::vector<insn_desc_t> instructions;
-  std::map<reg_t,uint64_t> pc_histogram;
-
-  static const size_t OPCODE_CACHE_SIZE = 8191;
-  insn_desc_t opcode_cache[OPCODE_CACHE_SIZE];
+  insn_profile_t profile;
+
+  // Decode tree, rebuilt by build_opcode_map() whenever instructions are
+  // registered. An inner node selects a child by a field of the instruction
+  // bits; a leaf lists the indices of the instructions that can still match,
+  // in order of precedence and ending with the catch-all illegal instruction.
+  struct decode_node_t {
+    uint32_t first; // first child, or first entry in decode_leaves
+    uint8_t shift;
+    uint8_t width;  // zero for a leaf
+  };
+  static const size_t DECODE_LEAF_SIZE = 8;
+  std::vector<decode_node_t> decode_nodes;
+  std::vector<uint16_t> decode_leaves;
 
   void take_pending_interrupt() { take_interrupt(state.mip & state.mie); }
   void take_interrupt(reg_t mask); // take first enabled interrupt in mask
   void take_trap(trap_t& t, reg_t epc); // take an exception
+  void take_trap_in_step(trap_t& t, reg_t epc);
   void disasm(insn_t insn); // disassemble and print an instruction
   int paddr_bits();
 
@@ -438,6 +502,8 @@ private:
   void parse_priv_string(const char*);
   void parse_isa_string(const char*);
   void build_opcode_map();
+  void build_decode_node(size_t node, const std::vector<uint16_t>& candidates, size_t level,
+                         std::map<std::vector<uint16_t>, uint32_t>& leaves);
   void register_base_instructions();
   insn_func_t decode_insn(insn_t insn);
 
@@ -472,13 +538,27 @@ public:
           reg_referenced[vReg] = 1;
 
 #ifdef RISCV_ENABLE_COMMITLOG
-          if (is_write)
+          if (is_write && p->get_log_commits())
             p->get_state()->log_reg_write[((vReg) << 2) | 2] = {0, 0};
 #endif
 
           T *regStart = (T*)((char*)reg_file + vReg * (VLEN >> 3));
           return regStart[n];
         }
+
+      // elements 0..n-1 of the register group starting at vReg, for loops
+      // that bypass elt(); only valid on little-endian hosts
+      template<class T>
+        T* elt_group(reg_t vReg, reg_t n, bool is_write = false){
+#ifdef RISCV_ENABLE_COMMITLOG
+          if (is_write && p->get_log_commits()) {
+            reg_t elts_per_reg = (VLEN >> 3) / sizeof(T);
+            for (reg_t r = 0; r * elts_per_reg < n; r++)
+              p->get_state()->log_reg_write[((vReg + r) << 2) | 2] = {0, 0};
+          }
+#endif
+          return (T*)((char*)reg_file + vReg * (VLEN >> 3));
+        }
     public:
 
       void reset();
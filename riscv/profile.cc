@@ -0,0 +1,104 @@
+// See LICENSE for license details.
+
+#include "profile.h"
+#include "disasm.h"
+#include <algorithm>
+#include <cinttypes>
+#include <iterator>
+
+const size_t insn_profile_t::INITIAL_SLOTS;
+const uint32_t insn_profile_t::EMPTY;
+const size_t insn_profile_t::HOT_INSNS;
+
+uint64_t* insn_profile_t::counter(reg_t pc, insn_bits_t bits)
+{
+  size_t mask = index.size() - 1;
+  for (size_t i = slot(pc); ; i = (i + 1) & mask) {
+    if (index[i] == EMPTY) {
+      index[i] = entries.size();
+      entries.push_back({pc, bits, 0});
+      uint64_t* count = &entries.back().count;
+      if (entries.size() * 2 > index.size())
+        grow();
+      return count;
+    }
+    if (entries[index[i]].pc == pc)
+      return &entries[index[i]].count;
+  }
+}
+
+void insn_profile_t::grow()
+{
+  index.assign(index.size() * 2, EMPTY);
+  size_t mask = index.size() - 1;
+  for (size_t e = 0; e < entries.size(); e++) {
+    size_t i = slot(entries[e].pc);
+    while (index[i] != EMPTY)
+      i = (i + 1) & mask;
+    index[i] = e;
+  }
+}
+
+void insn_profile_t::print(FILE* out, const std::map<std::string, uint64_t>& symbols,
+                           const disassembler_t* disassembler) const
+{
+  // assembler-local labels would split functions at every branch target
+  std::map<reg_t, const std::string*> by_addr;
+  for (auto& sym : symbols)
+    if (!sym.first.empty() && sym.first.compare(0, 2, ".L") != 0)
+      by_addr.emplace(sym.second, &sym.first);
+
+  // the symbol covering pc, or by_addr.end() if there is none below it
+  auto locate = [&](reg_t pc) -> std::map<reg_t, const std::string*>::const_iterator {
+    auto it = by_addr.upper_bound(pc);
+    return it == by_addr.begin() ? by_addr.end() : std::prev(it);
+  };
+
+  static const std::string unknown = "??";
+  std::map<const std::string*, uint64_t> functions;
+  std::vector<const entry_t*> hot;
+  uint64_t total = 0;
+  for (auto& e : entries) {
+    if (!e.count)
+      continue;
+    auto sym = locate(e.pc);
+    functions[sym == by_addr.end() ? &unknown : sym->second] += e.count;
+    hot.push_back(&e);
+    total += e.count;
+  }
+
+  fprintf(out, "Profile: %" PRIu64 " instructions executed at %zu PCs\n", total, hot.size());
+  if (!total)
+    return;
+
+  std::vector<std::pair<uint64_t, const std::string*>> by_count;
+  for (auto& f : functions)
+    by_count.push_back({f.second, f.first});
+  std::sort(by_count.begin(), by_count.end(), [](const std::pair<uint64_t, const std::string*>& a,
+                                                 const std::pair<uint64_t, const std::string*>& b) {
+    return a.first != b.first ? a.first > b.first : *a.second < *b.second;
+  });
+
+  fprintf(out, "\n%20s %7s  %s\n", "count", "%", "function");
+  for (auto& f : by_count)
+    fprintf(out, "%20" PRIu64 " %6.2f%%  %s\n", f.first, 100.0 * f.first / total, f.second->c_str());
+
+  size_t n = std::min(hot.size(), HOT_INSNS);
+  std::partial_sort(hot.begin(), hot.begin() + n, hot.end(), [](const entry_t* a, const entry_t* b) {
+    return a->count != b->count ? a->count > b->count : a->pc < b->pc;
+  });
+
+  fprintf(out, "\n%20s %7s  %-18s  %-32s  %s\n", "count", "%", "pc", "location", "instruction");
+  for (size_t i = 0; i < n; i++) {
+    const entry_t* e = hot[i];
+    auto sym = locate(e->pc);
+    char location[64];
+    if (sym == by_addr.end())
+      snprintf(location, sizeof(location), "??");
+    else
+      snprintf(location, sizeof(location), "%s+0x%" PRIx64, sym->second->c_str(), e->pc - sym->first);
+    fprintf(out, "%20" PRIu64 " %6.2f%%  0x%016" PRIx64 "  %-32s  %s\n", e->count,
+            100.0 * e->count / total, e->pc, location,
+            disassembler->disassemble(insn_t(e->bits)).c_str());
+  }
+}
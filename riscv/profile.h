@@ -0,0 +1,52 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_PROFILE_H
+#define _RISCV_PROFILE_H
+
+#include "decode.h"
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <string>
+#include <vector>
+
+class disassembler_t;
+
+// Execution counts per instruction address, for spike -g. Each address gets
+// one counter whose location never moves, so decoded icache entries can keep
+// a pointer to it and count an instruction with a single increment; only
+// instructions executed without a decoded entry go through the hash lookup.
+class insn_profile_t
+{
+ public:
+  insn_profile_t() : index(INITIAL_SLOTS, EMPTY) {}
+
+  // Returns the counter for pc, creating it (and remembering bits, for the
+  // disassembly) the first time pc is seen.
+  uint64_t* counter(reg_t pc, insn_bits_t bits);
+
+  // Prints execution counts per function and the hottest instructions,
+  // naming each address by the nearest symbol at or below it.
+  void print(FILE* out, const std::map<std::string, uint64_t>& symbols,
+             const disassembler_t* disassembler) const;
+
+ private:
+  struct entry_t {
+    reg_t pc;
+    insn_bits_t bits;
+    uint64_t count;
+  };
+
+  static const size_t INITIAL_SLOTS = 1024;
+  static const uint32_t EMPTY = UINT32_MAX;
+  static const size_t HOT_INSNS = 32;
+
+  size_t slot(reg_t pc) const { return (pc * 0x9e3779b97f4a7c15ULL >> 32) & (index.size() - 1); }
+  void grow();
+
+  std::deque<entry_t> entries;
+  std::vector<uint32_t> index; // open-addressed, indices into entries
+};
+
+#endif
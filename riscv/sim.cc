@@ -6,12 +6,15 @@
 #include "remote_bitbang.h"
 #include "byteorder.h"
 #include "rvfi_dii.h"
+#include "checkpoint.h"
+#include "commitlog.h"
 #include <map>
 #include <iostream>
 #include <sstream>
 #include <climits>
 #include <cstdlib>
 #include <cassert>
+#include <stdexcept>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
@@ -34,8 +37,11 @@ sim_t::sim_t(const char* isa, const char* priv, const char* varch,
              std::vector<int> const hartids,
              const debug_module_config_t &dm_config)
   : htif_t(args), mems(mems), plugin_devices(plugin_devices),
-    procs(std::max(nprocs, size_t(1))), start_pc(start_pc), current_step(0),
-    current_proc(0), debug(false), histogram_enabled(false),
+    procs(std::max(nprocs, size_t(1))), start_pc(start_pc),
+    interleave(INTERLEAVE), current_step(0), current_proc(0),
+    insns_per_hart(0), checkpoint_save_insns(0),
+    parallel(false), quantum_generation(0), harts_running(0),
+    hart_threads_exit(false), debug(false), histogram_enabled(false),
     log_commits_enabled(false), dtb_enabled(true),
     remote_bitbang(NULL), remote_rvfi_dii(NULL), debug_module(this, dm_config)
 {
@@ -75,8 +81,11 @@ sim_t::sim_t(const char* isa, const char* priv, const char* varch,
 
 sim_t::~sim_t()
 {
-  for (size_t i = 0; i < procs.size(); i++)
+  stop_hart_threads();
+  for (size_t i = 0; i < procs.size(); i++) {
+    procs[i]->print_profile(get_symbols());
     delete procs[i];
+  }
   delete debug_mmu;
 }
 
@@ -97,8 +106,13 @@ void sim_t::main()
     else if (rvfi_dii) {
       remote_rvfi_dii->start(this);
     }
+    else if (parallel)
+      step_parallel();
     else
-      step(INTERLEAVE);
+      step(interleave);
+    if (!checkpoint_save_path.empty() && insns_per_hart >= checkpoint_save_insns &&
+        current_step == 0 && current_proc == 0)
+      save_checkpoint();
     if (remote_bitbang) {
       remote_bitbang->tick();
     }
@@ -116,17 +130,18 @@ void sim_t::step(size_t n, insn_t insn)
 {
   for (size_t i = 0, steps = 0; i < n; i += steps)
   {
-    steps = std::min(n - i, INTERLEAVE - current_step);
+    steps = std::min(n - i, interleave - current_step);
     procs[current_proc]->step(steps, insn);
 
     current_step += steps;
-    if (current_step == INTERLEAVE)
+    if (current_step == interleave)
     {
       current_step = 0;
       procs[current_proc]->get_mmu()->yield_load_reservation();
       if (++current_proc == procs.size()) {
         current_proc = 0;
-        clint->increment(INTERLEAVE / INSNS_PER_RTC_TICK);
+        insns_per_hart += interleave;
+        clint->increment(interleave / INSNS_PER_RTC_TICK);
       }
 
       host->switch_to();
@@ -134,6 +149,73 @@ void sim_t::step(size_t n, insn_t insn)
   }
 }
 
+// Run one quantum of interleave instructions on every hart at once: hart 0
+// runs on this thread, the others on their own host threads. Shared state
+// (the CLINT's mtime, LR/SC reservations, htif) is only advanced once every
+// hart has reached the end of the quantum.
+void sim_t::step_parallel()
+{
+  if (hart_threads.empty())
+    for (size_t i = 1; i < procs.size(); i++)
+      hart_threads.emplace_back(&sim_t::hart_thread_main, this, i);
+
+  {
+    std::lock_guard<std::mutex> lock(quantum_lock);
+    harts_running = procs.size() - 1;
+    quantum_generation++;
+  }
+  quantum_start.notify_all();
+
+  procs[0]->step(interleave);
+
+  {
+    std::unique_lock<std::mutex> lock(quantum_lock);
+    quantum_done.wait(lock, [&]{ return harts_running == 0; });
+  }
+
+  for (auto p : procs)
+    p->get_mmu()->yield_load_reservation();
+  insns_per_hart += interleave;
+  clint->increment(interleave / INSNS_PER_RTC_TICK);
+
+  host->switch_to();
+}
+
+void sim_t::hart_thread_main(size_t id)
+{
+  uint64_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(quantum_lock);
+      quantum_start.wait(lock, [&]{
+        return hart_threads_exit || quantum_generation != generation;
+      });
+      if (hart_threads_exit)
+        return;
+      generation = quantum_generation;
+    }
+
+    procs[id]->step(interleave);
+
+    std::lock_guard<std::mutex> lock(quantum_lock);
+    if (--harts_running == 0)
+      quantum_done.notify_one();
+  }
+}
+
+void sim_t::stop_hart_threads()
+{
+  {
+    std::lock_guard<std::mutex> lock(quantum_lock);
+    hart_threads_exit = true;
+  }
+  quantum_start.notify_all();
+  for (auto& t : hart_threads)
+    t.join();
+  hart_threads.clear();
+  hart_threads_exit = false;
+}
+
 void sim_t::set_debug(bool value)
 {
   debug = value;
@@ -167,12 +249,34 @@ void sim_t::set_log_commits(bool value)
   }
 }
 
+void sim_t::set_commit_trace(const char* path)
+{
+  commit_trace.reset(new commit_trace_t(path));
+  log_commits_enabled = true;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->set_commit_trace(commit_trace.get());
+}
+
 void sim_t::set_procs_debug(bool value)
 {
   for (size_t i=0; i< procs.size(); i++)
     procs[i]->set_debug(value);
 }
 
+void sim_t::set_parallel(bool value)
+{
+  parallel = value;
+  for (size_t i = 0; i < procs.size(); i++)
+    procs[i]->get_mmu()->host_atomics = value;
+}
+
+void sim_t::set_interleave(size_t value)
+{
+  // the CLINT advances by whole RTC ticks at the end of each quantum
+  assert(value > 0 && value % INSNS_PER_RTC_TICK == 0);
+  interleave = value;
+}
+
 static bool paddr_ok(reg_t addr)
 {
   return (addr >> MAX_PADDR_BITS) == 0;
@@ -182,6 +286,9 @@ bool sim_t::mmio_load(reg_t addr, size_t len, uint8_t* bytes)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel)
+    lock.lock();
   return bus.load(addr, len, bytes);
 }
 
@@ -189,6 +296,9 @@ bool sim_t::mmio_store(reg_t addr, size_t len, const uint8_t* bytes)
 {
   if (addr + len < addr || !paddr_ok(addr + len - 1))
     return false;
+  std::unique_lock<std::mutex> lock(mmio_lock, std::defer_lock);
+  if (parallel)
+    lock.lock();
   return bus.store(addr, len, bytes);
 }
 
@@ -233,10 +343,11 @@ void sim_t::make_dtb()
 char* sim_t::addr_to_mem(reg_t addr) {
   if (!paddr_ok(addr))
     return NULL;
-  auto desc = bus.find_device(addr);
-  if (auto mem = dynamic_cast<mem_t*>(desc.second))
-    if (addr - desc.first < mem->size())
-      return mem->contents() + (addr - desc.first);
+  // each hart's thread keeps its own last-hit hint
+  static thread_local size_t hint = 0;
+  auto range = bus.find_range(addr, &hint);
+  if (range && range->kind == bus_t::MEMORY && addr - range->base < range->size)
+    return range->contents + (addr - range->base);
   return NULL;
 }
 
@@ -248,6 +359,49 @@ void sim_t::reset()
     make_dtb();
 }
 
+// The checkpoint holds the harts, the CLINT and main memory.  The boot ROM
+// is rebuilt from the command line, and plugin devices are not saved.
+void sim_t::checkpoint(checkpoint_t& cp)
+{
+  cp.check(procs.size(), "number of harts");
+  cp.check(mems.size(), "number of memories");
+  for (auto& m : mems) {
+    cp.check(m.first, "memory base");
+    cp.check(m.second->size(), "memory size");
+  }
+  cp.field(insns_per_hart);
+
+  for (auto p : procs)
+    p->checkpoint(cp);
+  clint->checkpoint(cp);
+  for (auto& m : mems)
+    cp.memory(m.second->contents(), m.second->size());
+}
+
+void sim_t::restore_checkpoint(const std::string& path)
+{
+  checkpoint_reader_t cp(path);
+  checkpoint(cp);
+  // the program load that follows must leave the restored memory alone
+  checkpoint_restore_path = path;
+}
+
+void sim_t::save_checkpoint()
+{
+  // this runs on the target thread, which has no one to throw to
+  try {
+    checkpoint_writer_t cp(checkpoint_save_path);
+    checkpoint(cp);
+    cp.close();
+  } catch (std::runtime_error& e) {
+    fprintf(stderr, "%s\n", e.what());
+    exit(1);
+  }
+  fprintf(stderr, "Saved checkpoint %s after %" PRIu64 " instructions per hart\n",
+          checkpoint_save_path.c_str(), insns_per_hart);
+  checkpoint_save_path.clear();
+}
+
 void sim_t::idle()
 {
   target.switch_to();
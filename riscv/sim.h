@@ -12,6 +12,9 @@
 #include <vector>
 #include <string>
 #include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <sys/types.h>
 
 class mmu_t;
@@ -37,7 +40,19 @@ public:
   void set_rvfi_dii(bool value);
   void set_histogram(bool value);
   void set_log_commits(bool value);
+  void set_commit_trace(const char* path);
   void set_procs_debug(bool value);
+  void set_parallel(bool value);
+  void set_interleave(size_t value);
+  // Save a checkpoint to path once every hart has executed insns
+  // instructions; restore one in place of the initial program load.
+  void set_checkpoint_save(const std::string& path, uint64_t insns) {
+    checkpoint_save_path = path;
+    checkpoint_save_insns = insns;
+  }
+  // Throws std::runtime_error if the checkpoint can't be read or doesn't
+  // match this machine; call before run().
+  void restore_checkpoint(const std::string& path);
   void set_dtb_enabled(bool value) {
     this->dtb_enabled = value;
   }
@@ -71,13 +86,37 @@ private:
   static const size_t INTERLEAVE = 5000;
   static const size_t INSNS_PER_RTC_TICK = 100; // 10 MHz clock for 1 BIPS core
   static const size_t CPU_HZ = 1000000000; // 1GHz CPU
+  size_t interleave;
   size_t current_step;
   size_t current_proc;
+  uint64_t insns_per_hart; // instructions each hart has run, in whole rounds
+
+  std::string checkpoint_save_path;
+  uint64_t checkpoint_save_insns;
+  std::string checkpoint_restore_path;
+  void checkpoint(checkpoint_t& cp);
+  void save_checkpoint();
+
+  // parallel mode: each hart runs on its own host thread, and all harts
+  // meet at a barrier every interleave instructions
+  bool parallel;
+  std::vector<std::thread> hart_threads;
+  std::mutex quantum_lock;
+  std::condition_variable quantum_start;
+  std::condition_variable quantum_done;
+  uint64_t quantum_generation;
+  size_t harts_running;
+  bool hart_threads_exit;
+  std::mutex mmio_lock;
+  void step_parallel();
+  void hart_thread_main(size_t id);
+  void stop_hart_threads();
   bool debug;
   bool log;
   bool rvfi_dii;
   bool histogram_enabled; // provide a histogram of PCs
   bool log_commits_enabled;
+  std::unique_ptr<commit_trace_t> commit_trace;
   bool dtb_enabled;
   remote_bitbang_t* remote_bitbang;
   rvfi_dii_t* remote_rvfi_dii;
@@ -134,6 +173,9 @@ private:
   context_t target;
   void reset();
   void idle();
+  bool is_address_preloaded(addr_t taddr, size_t len) {
+    return !checkpoint_restore_path.empty();
+  }
   void read_chunk(addr_t taddr, size_t len, void* dst);
   void write_chunk(addr_t taddr, size_t len, const void* src);
   size_t chunk_align() { return 8; }
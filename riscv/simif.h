@@ -4,6 +4,9 @@
 #define _RISCV_SIMIF_H
 
 #include "decode.h"
+#include <vector>
+
+class mem_t;
 
 // this is the interface to the simulator used by the processors and memory
 class simif_t
@@ -16,6 +19,8 @@ public:
   virtual bool mmio_store(reg_t addr, size_t len, const uint8_t* bytes) = 0;
   // Callback for processors to let the simulation know they were reset.
   virtual void proc_reset(unsigned id) = 0;
+  // the main memory ranges, as (base address, memory) pairs
+  virtual std::vector<std::pair<reg_t, mem_t*>> get_mems() = 0;
 };
 
 #endif
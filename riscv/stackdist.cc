@@ -0,0 +1,132 @@
+// See LICENSE for license details.
+
+#include "stackdist.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+static void help()
+{
+  std::cerr << "Miss-ratio curve configurations must be of the form" << std::endl;
+  std::cerr << "  blocksize:sets:ways[:insn|data|all]" << std::endl;
+  std::cerr << "where blocksize and sets are powers of two, blocksize is at least 8," << std::endl;
+  std::cerr << "and ways is between 1 and 1024. Curves are computed for every" << std::endl;
+  std::cerr << "power-of-two set count up to sets and every associativity up to" << std::endl;
+  std::cerr << "ways, from data accesses unless insn or all is given." << std::endl;
+  exit(1);
+}
+
+stackdist_sim_t::stackdist_sim_t(const char* config)
+  : trace_fetches(false), trace_data(true), accesses(0)
+{
+  const char* sp = strchr(config, ':');
+  if (!sp++) help();
+  const char* wp = strchr(sp, ':');
+  if (!wp++) help();
+  const char* kp = strchr(wp, ':');
+
+  linesz = atoi(std::string(config, sp).c_str());
+  size_t max_sets = atoi(std::string(sp, wp).c_str());
+  max_ways = atoi(kp ? std::string(wp, kp).c_str() : wp);
+
+  if (linesz < 8 || (linesz & (linesz - 1)))
+    help();
+  if (max_sets == 0 || (max_sets & (max_sets - 1)))
+    help();
+  if (max_ways == 0 || max_ways > 1024)
+    help();
+
+  if (kp) {
+    std::string kind(kp + 1);
+    if (kind == "insn")
+      trace_fetches = true, trace_data = false;
+    else if (kind == "all")
+      trace_fetches = true;
+    else if (kind != "data")
+      help();
+  }
+
+  idx_shift = 0;
+  for (size_t x = linesz; x > 1; x >>= 1)
+    idx_shift++;
+
+  for (size_t sets = 1; sets <= max_sets; sets *= 2) {
+    level_t level;
+    level.sets = sets;
+    level.stacks.resize(sets * max_ways);
+    level.depth.resize(sets);
+    level.hits.resize(max_ways);
+    levels.push_back(level);
+  }
+}
+
+stackdist_sim_t::~stackdist_sim_t()
+{
+  printstats();
+}
+
+bool stackdist_sim_t::interested_in_range(uint64_t begin, uint64_t end, access_type type)
+{
+  return type == FETCH ? trace_fetches : trace_data;
+}
+
+void stackdist_sim_t::trace(uint64_t addr, size_t bytes, access_type type)
+{
+  if (!(type == FETCH ? trace_fetches : trace_data))
+    return;
+
+  uint64_t line = addr >> idx_shift;
+  accesses++;
+  for (auto& level : levels) {
+    size_t set = line & (level.sets - 1);
+    uint64_t* stack = &level.stacks[set * max_ways];
+    size_t& depth = level.depth[set];
+
+    // find the line, then move it to the top of the stack
+    size_t i = 0;
+    while (i < depth && stack[i] != line)
+      i++;
+    if (i < depth)
+      level.hits[i]++;
+    else if (depth < max_ways)
+      depth++;
+    else
+      i = max_ways - 1; // the least recently used line drops off the bottom
+    memmove(stack + 1, stack, i * sizeof(*stack));
+    stack[0] = line;
+  }
+}
+
+void stackdist_sim_t::reset()
+{
+  accesses = 0;
+  for (auto& level : levels)
+    std::fill(level.hits.begin(), level.hits.end(), 0);
+}
+
+void stackdist_sim_t::printstats()
+{
+  if (!accesses)
+    return;
+
+  std::cout << "MRC LRU miss ratios for " << linesz << "-byte blocks, "
+            << accesses << " accesses" << std::endl;
+  std::cout << "MRC " << std::setw(8) << "Sets" << std::setw(6) << "Ways"
+            << std::setw(12) << "Bytes" << std::setw(14) << "Misses"
+            << std::setw(11) << "Miss Rate" << std::endl;
+  for (auto& level : levels) {
+    uint64_t misses = accesses;
+    for (size_t ways = 1; ways <= max_ways; ways++) {
+      misses -= level.hits[ways - 1];
+      float mr = 100.0f * misses / accesses;
+      std::cout << "MRC " << std::setw(8) << level.sets << std::setw(6) << ways
+                << std::setw(12) << level.sets * ways * linesz
+                << std::setw(14) << misses
+                << std::setw(10) << std::fixed << std::setprecision(3) << mr << '%'
+                << std::endl;
+    }
+  }
+}
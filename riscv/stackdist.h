@@ -0,0 +1,45 @@
+// See LICENSE for license details.
+
+#ifndef _RISCV_STACKDIST_H
+#define _RISCV_STACKDIST_H
+
+#include "memtracer.h"
+#include <cstdint>
+#include <vector>
+
+// Computes the LRU miss ratios of a whole family of cache geometries in a
+// single pass, using Mattson's stack algorithm. For each power-of-two set
+// count up to max_sets, every set keeps its lines in order of recency, up to
+// max_ways deep. The depth at which an access finds its line is the number
+// of ways below which it would have missed, so one pass yields the misses
+// of every associativity up to max_ways at once.
+class stackdist_sim_t : public memtracer_t
+{
+ public:
+  stackdist_sim_t(const char* config);
+  ~stackdist_sim_t();
+
+  bool interested_in_range(uint64_t begin, uint64_t end, access_type type);
+  void trace(uint64_t addr, size_t bytes, access_type type);
+  void reset();
+  void printstats();
+  void read_counter(uint64_t *ret_value, int idx) {}
+
+ private:
+  struct level_t {
+    size_t sets;
+    std::vector<uint64_t> stacks; // max_ways lines per set, most recent first
+    std::vector<size_t> depth;    // lines held by each set
+    std::vector<uint64_t> hits;   // accesses that found their line at each depth
+  };
+
+  size_t linesz;
+  size_t idx_shift;
+  size_t max_ways;
+  bool trace_fetches;
+  bool trace_data;
+  std::vector<level_t> levels;
+  uint64_t accesses;
+};
+
+#endif
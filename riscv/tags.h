@@ -34,35 +34,139 @@
 #ifndef _RISCV_TAGS_H
 #define _RISCV_TAGS_H
 
-// @tag_t the tag type fot a specific tagging implementation, for example bool
-// @N the number of elements to tag
-template <class tag_t, unsigned int N>
+#include "decode.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// Tag bits for the physical memory ranges of a machine, one bit per
+// GRANULE-byte granule.  Each range's bitmap is split into pages that are
+// only allocated when a tag in them is first set, so untagged memory costs
+// one pointer per page.  Addresses outside every range have no tags: they
+// read as clear and setting them has no effect.
+template <size_t GRANULE>
 class tags_t {
  public:
+  static const size_t PAGE_WORDS = 512;
+  static const reg_t PAGE_GRANULES = PAGE_WORDS * 64;
+
+  tags_t() : last_hit(0) {}
+  tags_t(const tags_t&) = delete;
+  ~tags_t() { reset(); }
 
-  tags_t() {
-    tags.reserve(N);
+  void add_range(reg_t base, reg_t size) {
+    range_t r;
+    r.base = base;
+    r.size = size;
+    r.pages.resize((size / GRANULE + PAGE_GRANULES - 1) / PAGE_GRANULES);
+    ranges.push_back(std::move(r));
   }
 
-  ~tags_t() {
+  bool empty() const { return ranges.empty(); }
+
+  // Clear every tag, releasing the bitmap pages.
+  void reset() {
+    for (auto& r : ranges)
+      for (auto& page : r.pages) {
+        free(page);
+        page = NULL;
+      }
   }
 
-  virtual void init() {};
+  bool get(reg_t paddr) {
+    range_t* r = find(paddr);
+    if (!r)
+      return false;
+    reg_t g = (paddr - r->base) / GRANULE;
+    uint64_t* page = r->pages[g / PAGE_GRANULES];
+    if (!page)
+      return false;
+    g %= PAGE_GRANULES;
+    return (page[g / 64] >> (g % 64)) & 1;
+  }
 
-  // Zero tags on reset
-  virtual void reset() {
-    std::fill(tags.begin(), tags.end(), 0);
+  void set(reg_t paddr, bool val) {
+    if (!val) {
+      clear(paddr, 1);
+      return;
+    }
+    range_t* r = find(paddr);
+    if (!r)
+      return;
+    reg_t g = (paddr - r->base) / GRANULE;
+    uint64_t*& page = r->pages[g / PAGE_GRANULES];
+    if (!page && !(page = (uint64_t*)calloc(PAGE_WORDS, sizeof(uint64_t))))
+      throw std::bad_alloc();
+    g %= PAGE_GRANULES;
+    page[g / 64] |= uint64_t(1) << (g % 64);
   }
 
-  virtual void setTag(unsigned element_idx, tag_t tagval) {
-    tags[element_idx] = tagval;
+  // Clear the tag of every granule that overlaps [paddr, paddr + len),
+  // which must not span memory ranges.  Whole bitmap pages are released
+  // rather than cleared bit by bit.
+  void clear(reg_t paddr, reg_t len) {
+    range_t* r = find(paddr);
+    if (!r || !len)
+      return;
+    reg_t g = (paddr - r->base) / GRANULE;
+    reg_t end = (std::min(paddr - r->base + len, r->size) - 1) / GRANULE + 1;
+    while (g < end) {
+      reg_t page_base = g / PAGE_GRANULES * PAGE_GRANULES;
+      reg_t stop = std::min(end, page_base + PAGE_GRANULES);
+      uint64_t*& page = r->pages[g / PAGE_GRANULES];
+      if (page && g == page_base && stop == page_base + PAGE_GRANULES) {
+        free(page);
+        page = NULL;
+      } else if (page) {
+        for (reg_t i = g - page_base; i < stop - page_base; ) {
+          reg_t n = std::min<reg_t>(64 - i % 64, stop - page_base - i);
+          page[i / 64] &= ~(mask(n) << (i % 64));
+          i += n;
+        }
+      }
+      g = stop;
+    }
   }
 
-  virtual tag_t getTag(unsigned element_idx) {
-    return tags[element_idx];
+  // Call f(paddr) for the base address of every tagged granule.
+  template <class F>
+  void for_each(F f) {
+    for (auto& r : ranges)
+      for (size_t p = 0; p < r.pages.size(); p++)
+        if (r.pages[p])
+          for (size_t w = 0; w < PAGE_WORDS; w++)
+            for (uint64_t bits = r.pages[p][w]; bits; bits &= bits - 1) {
+              reg_t g = p * PAGE_GRANULES + w * 64 + __builtin_ctzll(bits);
+              f(r.base + g * GRANULE);
+            }
   }
 
  private:
-  std::vector<tag_t> tags;
+  struct range_t {
+    reg_t base;
+    reg_t size;
+    std::vector<uint64_t*> pages;
+  };
+
+  static uint64_t mask(reg_t n) {
+    return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+  }
+
+  range_t* find(reg_t paddr) {
+    if (likely(last_hit < ranges.size()) &&
+        paddr - ranges[last_hit].base < ranges[last_hit].size)
+      return &ranges[last_hit];
+    for (size_t i = 0; i < ranges.size(); i++) {
+      if (paddr - ranges[i].base < ranges[i].size) {
+        last_hit = i;
+        return &ranges[i];
+      }
+    }
+    return NULL;
+  }
+
+  std::vector<range_t> ranges;
+  size_t last_hit;
 };
 #endif /* _RISCV_TAGS_H */
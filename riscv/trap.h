@@ -17,7 +17,7 @@ class trap_t
   virtual reg_t get_tval() { return 0; }
   reg_t cause() { return which; }
  private:
-  char _name[16];
+  char _name[16] = {};
   reg_t which;
 };
 
@@ -32,6 +32,25 @@ class mem_trap_t : public trap_t
   reg_t tval;
 };
 
+// A copy of a trap, recorded by processor_t::defer_trap to be delivered
+// without unwinding the stack.  The traps declared below all have static
+// names, so the name is kept by reference.
+class pending_trap_t : public trap_t
+{
+ public:
+  pending_trap_t() : trap_t(0), tval_valid(false), tval(0), trap_name("") {}
+  pending_trap_t(trap_t& t)
+    : trap_t(t.cause()), tval_valid(t.has_tval()), tval(t.get_tval()),
+      trap_name(t.name()) {}
+  const char* name() override { return trap_name; }
+  bool has_tval() override { return tval_valid; }
+  reg_t get_tval() override { return tval; }
+ private:
+  bool tval_valid;
+  reg_t tval;
+  const char* trap_name;
+};
+
 #define DECLARE_TRAP(n, x) class trap_##x : public trap_t { \
  public: \
   trap_##x() : trap_t(n) {} \
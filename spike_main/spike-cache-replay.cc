@@ -0,0 +1,122 @@
+// See LICENSE for license details.
+
+// Feeds a memory trace, as written by
+//   spike --mem-trace=<file>
+// through a number of cache hierarchies, each on its own host thread, and
+// prints the statistics --ic, --dc and --l2 would have given for each.
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "cachesim.h"
+#include "memtracefile.h"
+
+struct hierarchy_t {
+  std::string spec;
+  std::unique_ptr<icache_sim_t> ic;
+  std::unique_ptr<dcache_sim_t> dc;
+  std::unique_ptr<cache_sim_t> l2;
+  std::string error;
+};
+
+static void usage()
+{
+  fprintf(stderr, "usage: spike-cache-replay [-j <threads>] <trace file> <hierarchy>...\n");
+  fprintf(stderr, "Each hierarchy is a comma-separated list of ic=<config>, dc=<config>\n");
+  fprintf(stderr, "and l2=<config>, where the configurations are as for spike's --ic,\n");
+  fprintf(stderr, "--dc and --l2 options, e.g. dc=64:8:64:lru,l2=512:8:64\n");
+  exit(1);
+}
+
+static void parse_hierarchy(hierarchy_t& h)
+{
+  for (size_t pos = 0; pos < h.spec.size(); ) {
+    size_t end = h.spec.find(',', pos);
+    if (end == std::string::npos)
+      end = h.spec.size();
+    std::string item = h.spec.substr(pos, end - pos);
+    pos = end + 1;
+
+    if (item.compare(0, 3, "ic=") == 0)
+      h.ic.reset(new icache_sim_t(item.c_str() + 3));
+    else if (item.compare(0, 3, "dc=") == 0)
+      h.dc.reset(new dcache_sim_t(item.c_str() + 3));
+    else if (item.compare(0, 3, "l2=") == 0)
+      h.l2.reset(cache_sim_t::construct(item.c_str() + 3, "L2$"));
+    else
+      usage();
+  }
+
+  if (h.ic && h.l2) h.ic->set_miss_handler(&*h.l2);
+  if (h.dc && h.l2) h.dc->set_miss_handler(&*h.l2);
+}
+
+static void replay(const char* path, hierarchy_t& h)
+{
+  try {
+    memtrace_reader_t reader(path);
+    memtrace_record_t rec;
+    unsigned hart;
+    // as in spike, all harts share the one hierarchy
+    while (reader.next(rec, hart)) {
+      if (h.ic) h.ic->trace(rec.addr, rec.bytes, rec.type);
+      if (h.dc) h.dc->trace(rec.addr, rec.bytes, rec.type);
+    }
+  } catch (std::exception& e) {
+    h.error = e.what();
+  }
+}
+
+int main(int argc, char** argv)
+{
+  unsigned threads = std::thread::hardware_concurrency();
+  int arg = 1;
+  if (arg < argc && strncmp(argv[arg], "-j", 2) == 0) {
+    const char* n = argv[arg][2] ? &argv[arg][2] : argv[++arg];
+    if (!n || (threads = atoi(n)) == 0)
+      usage();
+    arg++;
+  }
+  if (argc - arg < 2)
+    usage();
+
+  const char* path = argv[arg++];
+  std::vector<hierarchy_t> hierarchies(argc - arg);
+  for (size_t i = 0; i < hierarchies.size(); i++) {
+    hierarchies[i].spec = argv[arg + i];
+    parse_hierarchy(hierarchies[i]);
+  }
+
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < std::max(1u, threads) && i < hierarchies.size(); i++) {
+    workers.emplace_back([&] {
+      for (size_t j; (j = next++) < hierarchies.size(); )
+        replay(path, hierarchies[j]);
+    });
+  }
+  for (auto& w : workers)
+    w.join();
+
+  // the caches print their statistics as they are destroyed
+  int status = 0;
+  for (auto& h : hierarchies) {
+    std::cout << "== " << h.spec << std::endl;
+    if (!h.error.empty()) {
+      fprintf(stderr, "spike-cache-replay: %s\n", h.error.c_str());
+      status = 1;
+    }
+    h.l2.reset();
+    h.dc.reset();
+    h.ic.reset();
+  }
+  return status;
+}
@@ -0,0 +1,98 @@
+// See LICENSE for license details.
+
+// This little program turns a binary commit trace, as written by
+//   spike --commit-trace=<file>
+// back into the text printed by spike --log-commits.
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "decode.h"
+#include "commitlog.h"
+
+static FILE* in;
+
+static void read_or_die(void* data, size_t len)
+{
+  if (fread(data, 1, len, in) != len) {
+    fprintf(stderr, "spike-commit-decode: truncated trace\n");
+    exit(1);
+  }
+}
+
+template<class T> static T get()
+{
+  T value;
+  read_or_die(&value, sizeof(value));
+  return value;
+}
+
+int main(int argc, char** argv)
+{
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-' && argv[1][1])) {
+    fprintf(stderr, "usage: spike-commit-decode [<trace file>]\n");
+    return 1;
+  }
+
+  in = argc == 2 && strcmp(argv[1], "-") != 0 ? fopen(argv[1], "rb") : stdin;
+  if (!in) {
+    fprintf(stderr, "spike-commit-decode: couldn't open %s: %s\n", argv[1], strerror(errno));
+    return 1;
+  }
+
+  char magic[sizeof(COMMIT_TRACE_MAGIC) - 1];
+  read_or_die(magic, sizeof(magic));
+  if (memcmp(magic, COMMIT_TRACE_MAGIC, sizeof(magic)) != 0) {
+    fprintf(stderr, "spike-commit-decode: not a commit trace\n");
+    return 1;
+  }
+
+  std::vector<uint64_t> vreg;
+  FILE* out = stdout;
+  commit_trace_insn_t rec;
+  while (fread(&rec, 1, sizeof(rec), in) == sizeof(rec)) {
+    fprintf(out, "%1d ", rec.priv);
+    commit_log_print_value(out, rec.xlen, 0, rec.pc);
+    fprintf(out, " (");
+    commit_log_print_value(out, insn_t(rec.bits).length() * 8, 0, rec.bits);
+    fprintf(out, ")");
+
+    for (unsigned i = 0; i < rec.nregs; i++) {
+      auto r = get<commit_trace_reg_t>();
+      static const char prefix[] = {'x', 'f', 'v'};
+      if ((r.key & 3) == 2) {
+        vreg.resize((r.width + 63) / 64);
+        read_or_die(&vreg[0], r.width / 8);
+        fprintf(out, " e%d m%d", r.vsew, r.vlmul);
+        fprintf(out, " %c%2d ", prefix[r.key & 3], r.key >> 2);
+        commit_log_print_value(out, r.width, &vreg[0]);
+      } else {
+        uint64_t v[2];
+        read_or_die(v, sizeof(v));
+        fprintf(out, " %c%2d ", prefix[r.key & 3], r.key >> 2);
+        commit_log_print_value(out, r.width, v[1], v[0]);
+      }
+    }
+
+    for (unsigned i = 0; i < rec.nloads; i++) {
+      fprintf(out, " mem ");
+      commit_log_print_value(out, rec.xlen, 0, get<uint64_t>());
+    }
+
+    for (unsigned i = 0; i < rec.nstores; i++) {
+      uint64_t addr = get<uint64_t>();
+      uint64_t value = get<uint64_t>();
+      uint8_t size = get<uint8_t>();
+      fprintf(out, " mem ");
+      commit_log_print_value(out, rec.xlen, 0, addr);
+      fprintf(out, " ");
+      commit_log_print_value(out, size << 3, 0, value);
+    }
+    fprintf(out, "\n");
+  }
+
+  return 0;
+}
@@ -5,6 +5,9 @@
 #include "remote_bitbang.h"
 #include "rvfi_dii.h"
 #include "cachesim.h"
+#include "coherence.h"
+#include "stackdist.h"
+#include "memtracefile.h"
 #include "extension.h"
 #include <dlfcn.h>
 #include <fesvr/option_parser.h>
@@ -28,8 +31,11 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  -m<n>                 Provide <n> MiB of target memory [default 2048]\n");
   fprintf(stderr, "  -m<a:m,b:n,...>       Provide memory regions of size m and n bytes\n");
   fprintf(stderr, "                          at base addresses a and b (with 4 KiB alignment)\n");
+  fprintf(stderr, "  --hugepages           Back target memory with transparent huge pages\n");
+  fprintf(stderr, "  --host-fp             Run common F/D operations on the host FPU where\n");
+  fprintf(stderr, "                          that gives the same results as softfloat\n");
   fprintf(stderr, "  -d                    Interactive debug mode\n");
-  fprintf(stderr, "  -g                    Track histogram of PCs\n");
+  fprintf(stderr, "  -g                    Profile executed instructions by function and PC\n");
   fprintf(stderr, "  -l                    Generate a log of execution\n");
   fprintf(stderr, "  -h, --help            Print this help message\n");
   fprintf(stderr, "  -H                    Start halted, allowing a debugger to connect\n");
@@ -38,9 +44,33 @@ static void help(int exit_code = 1)
   fprintf(stderr, "  --varch=<name>        RISC-V Vector uArch string [default %s]\n", DEFAULT_VARCH);
   fprintf(stderr, "  --pc=<address>        Override ELF entry point\n");
   fprintf(stderr, "  --hartids=<a,b,...>   Explicitly specify hartids, default is 0,1,...\n");
+  fprintf(stderr, "  --parallel            Run each processor on its own host thread\n");
+  fprintf(stderr, "  --quantum=<n>         Run <n> instructions per processor between\n");
+  fprintf(stderr, "                          synchronisation points, a multiple of 100\n");
+  fprintf(stderr, "                          (one timer tick) [default 5000]\n");
   fprintf(stderr, "  --ic=<S>:<W>:<B>      Instantiate a cache model with S sets,\n");
   fprintf(stderr, "  --dc=<S>:<W>:<B>        W ways, and B-byte blocks (with S and\n");
-  fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).\n");
+  fprintf(stderr, "  --l2=<S>:<W>:<B>        B both powers of 2).  Append :<policy>\n");
+  fprintf(stderr, "                          (random, lru, plru or srrip) to choose the\n");
+  fprintf(stderr, "                          replacement policy, and :<prefetcher>\n");
+  fprintf(stderr, "                          (nextline or stride) to add a prefetcher\n");
+  fprintf(stderr, "  --coherent            Give each processor its own --ic and --dc, and\n");
+  fprintf(stderr, "                          keep the data caches coherent with MESI\n");
+  fprintf(stderr, "  --mem-trace=<file>    Write the physical addresses of all fetches,\n");
+  fprintf(stderr, "                          loads and stores to <file>, to be replayed\n");
+  fprintf(stderr, "                          through cache models by spike-cache-replay\n");
+  fprintf(stderr, "  --mrc=<B>:<S>:<W>     Print LRU miss ratios of B-byte-block caches\n");
+  fprintf(stderr, "                          with up to S sets and W ways, for data\n");
+  fprintf(stderr, "                          accesses (append :insn or :all for others)\n");
+  fprintf(stderr, "  --tlb=<S>:<W>         Size the second-level TLB as S sets of W ways\n");
+  fprintf(stderr, "                          [default 512:4]\n");
+  fprintf(stderr, "  --commit-trace=<file>  Write the commit log to <file> in binary form,\n");
+  fprintf(stderr, "                          to be decoded with spike-commit-decode\n");
+  fprintf(stderr, "  --save-checkpoint=<file>  Save the machine state to <file> once each\n");
+  fprintf(stderr, "                          processor has run --checkpoint-after instructions\n");
+  fprintf(stderr, "  --checkpoint-after=<n>  Instructions per processor before saving [default 0]\n");
+  fprintf(stderr, "  --restore-checkpoint=<file>  Resume from a saved checkpoint instead of\n");
+  fprintf(stderr, "                          loading the program into memory\n");
   fprintf(stderr, "  --device=<P,B,A>      Attach MMIO plugin device from an --extlib library\n");
   fprintf(stderr, "                          P -- Name of the MMIO plugin\n");
   fprintf(stderr, "                          B -- Base memory address of the device\n");
@@ -120,11 +150,26 @@ int main(int argc, char** argv)
   reg_t start_pc = reg_t(-1);
   std::vector<std::pair<reg_t, mem_t*>> mems;
   std::vector<std::pair<reg_t, abstract_device_t*>> plugin_devices;
-  std::unique_ptr<icache_sim_t> ic;
-  std::unique_ptr<dcache_sim_t> dc;
+  const char* ic_config = NULL;
+  const char* dc_config = NULL;
+  bool coherent = false;
+  std::unique_ptr<coherence_t> coherence;
+  std::vector<std::unique_ptr<icache_sim_t>> ic;
+  std::vector<std::unique_ptr<dcache_sim_t>> dc;
   std::unique_ptr<cache_sim_t> l2;
+  std::unique_ptr<stackdist_sim_t> mrc;
+  std::unique_ptr<memtrace_writer_t> mem_trace;
   bool log_cache = false;
   bool log_commits = false;
+  const char* commit_trace = NULL;
+  bool parallel = false;
+  size_t tlb_sets = 0, tlb_ways = 0;
+  bool hugepages = false;
+  bool host_fp = false;
+  const char* save_checkpoint = NULL;
+  const char* restore_checkpoint = NULL;
+  uint64_t checkpoint_after = 0;
+  size_t interleave = 0;
   std::function<extension_t*()> extension;
   const char* isa = DEFAULT_ISA;
   const char* priv = DEFAULT_PRIV;
@@ -213,9 +258,39 @@ int main(int argc, char** argv)
   parser.option(0, "rvfi-dii-port", 1, [&](const char* s){rvfi_dii = true; rvfi_dii_port = atoi(s);});
   parser.option(0, "pc", 1, [&](const char* s){start_pc = strtoull(s, 0, 0);});
   parser.option(0, "hartids", 1, hartids_parser);
-  parser.option(0, "ic", 1, [&](const char* s){ic.reset(new icache_sim_t(s));});
-  parser.option(0, "dc", 1, [&](const char* s){dc.reset(new dcache_sim_t(s));});
+  parser.option(0, "parallel", 0, [&](const char* s){parallel = true;});
+  parser.option(0, "quantum", 1, [&](const char* s){
+    interleave = strtoull(s, 0, 0);
+    // the timer advances by whole ticks of 100 instructions per quantum
+    if (interleave == 0 || interleave % 100 != 0) {
+      fprintf(stderr, "--quantum must be a positive multiple of 100\n");
+      exit(1);
+    }
+  });
+  parser.option(0, "ic", 1, [&](const char* s){ic_config = s;});
+  parser.option(0, "dc", 1, [&](const char* s){dc_config = s;});
+  parser.option(0, "coherent", 0, [&](const char* s){coherent = true;});
   parser.option(0, "l2", 1, [&](const char* s){l2.reset(cache_sim_t::construct(s, "L2$"));});
+  parser.option(0, "mrc", 1, [&](const char* s){mrc.reset(new stackdist_sim_t(s));});
+  parser.option(0, "mem-trace", 1, [&](const char* s){
+    try {
+      mem_trace.reset(new memtrace_writer_t(s));
+    } catch (std::runtime_error& e) {
+      fprintf(stderr, "%s\n", e.what());
+      exit(1);
+    }
+  });
+  parser.option(0, "tlb", 1, [&](const char* s){
+    if (sscanf(s, "%zu:%zu", &tlb_sets, &tlb_ways) != 2 || !tlb_sets || !tlb_ways) {
+      fprintf(stderr, "--tlb expects <sets>:<ways>, both nonzero\n");
+      exit(1);
+    }
+  });
+  parser.option(0, "hugepages", 0, [&](const char* s){hugepages = true;});
+  parser.option(0, "host-fp", 0, [&](const char* s){host_fp = true;});
+  parser.option(0, "save-checkpoint", 1, [&](const char* s){save_checkpoint = s;});
+  parser.option(0, "checkpoint-after", 1, [&](const char* s){checkpoint_after = strtoull(s, 0, 0);});
+  parser.option(0, "restore-checkpoint", 1, [&](const char* s){restore_checkpoint = s;});
   parser.option(0, "log-cache-miss", 0, [&](const char* s){log_cache = true;});
   parser.option(0, "isa", 1, [&](const char* s){isa = s;});
   parser.option(0, "priv", 1, [&](const char* s){priv = s;});
@@ -253,11 +328,35 @@ int main(int argc, char** argv)
   parser.option(0, "dm-no-halt-groups", 0,
       [&](const char* s){dm_config.support_haltgroups = false;});
   parser.option(0, "log-commits", 0, [&](const char* s){log_commits = true;});
+  parser.option(0, "commit-trace", 1, [&](const char* s){commit_trace = s;});
 
   auto argv1 = parser.parse(argv);
+
+  // one pair of caches shared by all harts, or private ones for each
+  size_t ncaches = coherent ? nprocs : 1;
+  for (size_t i = 0; i < ncaches; i++) {
+    std::string suffix = coherent ? std::to_string(i) : "";
+    if (ic_config)
+      ic.emplace_back(new icache_sim_t(ic_config, ("I$" + suffix).c_str()));
+    if (dc_config)
+      dc.emplace_back(new dcache_sim_t(dc_config, ("D$" + suffix).c_str()));
+  }
+  if (coherent && dc_config) {
+    coherence.reset(new coherence_t);
+    for (auto& c : dc)
+      c->set_coherence(&*coherence);
+  }
   std::vector<std::string> htif_args(argv1, (const char*const*)argv + argc);
   if (mems.empty())
     mems = make_mems("2048");
+  if (hugepages) {
+    // only a speed hint, so run without them if the host refuses
+    bool ok = true;
+    for (auto& mem : mems)
+      ok = mem.second->use_hugepages() && ok;
+    if (!ok)
+      fprintf(stderr, "warning: huge pages are not available for target memory; continuing without them\n");
+  }
 
   /* If RVFI_DII is enabled, there is no need to load program from command line */
   if (!*argv1 && !rvfi_dii)
@@ -289,15 +388,34 @@ int main(int argc, char** argv)
     return 0;
   }
 
-  if (ic && l2) ic->set_miss_handler(&*l2);
-  if (dc && l2) dc->set_miss_handler(&*l2);
-  if (ic) ic->set_log(log_cache);
-  if (dc) dc->set_log(log_cache);
+  // the cache models are shared between harts and are not thread-safe
+  if (parallel && (!ic.empty() || !dc.empty() || l2 || mrc || mem_trace)) {
+    fprintf(stderr, "--parallel cannot be combined with --ic, --dc, --l2, --mrc or --mem-trace\n");
+    return 1;
+  }
+  // the text logs print each instruction piecemeal, so harts' lines would mix
+  if (parallel && (log || (log_commits && !commit_trace))) {
+    fprintf(stderr, "--parallel cannot be combined with -l or --log-commits; use --commit-trace\n");
+    return 1;
+  }
+
+  for (auto& c : ic) {
+    if (l2) c->set_miss_handler(&*l2);
+    c->set_log(log_cache);
+  }
+  for (auto& c : dc) {
+    if (l2) c->set_miss_handler(&*l2);
+    c->set_log(log_cache);
+  }
   for (size_t i = 0; i < nprocs; i++)
   {
-    if (ic) s.get_core(i)->get_mmu()->register_memtracer(&*ic);
-    if (dc) s.get_core(i)->get_mmu()->register_memtracer(&*dc);
+    if (!ic.empty()) s.get_core(i)->get_mmu()->register_memtracer(&*ic[i % ic.size()]);
+    if (!dc.empty()) s.get_core(i)->get_mmu()->register_memtracer(&*dc[i % dc.size()]);
+    if (mrc) s.get_core(i)->get_mmu()->register_memtracer(&*mrc);
+    if (mem_trace) s.get_core(i)->get_mmu()->register_memtracer(mem_trace->get_tracer(i));
     if (l2) s.get_core(i)->get_mmu()->register_l2cache(&*l2);
+    if (tlb_sets) s.get_core(i)->get_mmu()->set_stlb_geometry(tlb_sets, tlb_ways);
+    s.get_core(i)->set_host_fp(host_fp);
     if (extension) s.get_core(i)->register_extension(extension());
   }
 
@@ -306,6 +424,27 @@ int main(int argc, char** argv)
   s.set_histogram(histogram);
   s.set_rvfi_dii(rvfi_dii);
   s.set_log_commits(log_commits);
+  if (commit_trace) {
+    try {
+      s.set_commit_trace(commit_trace);
+    } catch (std::runtime_error& e) {
+      fprintf(stderr, "%s\n", e.what());
+      exit(1);
+    }
+  }
+  s.set_parallel(parallel);
+  if (interleave)
+    s.set_interleave(interleave);
+  if (save_checkpoint)
+    s.set_checkpoint_save(save_checkpoint, checkpoint_after);
+  if (restore_checkpoint) {
+    try {
+      s.restore_checkpoint(restore_checkpoint);
+    } catch (std::runtime_error& e) {
+      fprintf(stderr, "%s\n", e.what());
+      exit(1);
+    }
+  }
 
   auto return_code = s.run();
 